@@ -0,0 +1,83 @@
+/*
+ * amat.c - Cycle estimate of the simulated memory accesses
+ *
+ * Every access pays the hit latency, every miss the miss penalty on top
+ * and every block written to the next level the writeback cost. Misses
+ * may overlap: the first miss opens a group and pays the full penalty,
+ * up to mlp - 1 further misses within window accesses of it are issued
+ * while it is outstanding and add no stall of their own. A miss after
+ * the window closed, or with mlp misses outstanding, opens a new group.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cachelab.h"
+#include "amat.h"
+
+int parse_amat_config(amat_config *config, const char *spec)
+{
+    int fields;
+
+    memset(config, 0, sizeof(*config));
+    config->mlp = 1;
+    fields = sscanf(spec, "%d,%d,%d,%d,%d", &config->hit_latency,
+                    &config->miss_penalty, &config->writeback_cost,
+                    &config->mlp, &config->window);
+    if (fields != 3 && fields != 5)
+        return 0;
+    return config->hit_latency >= 0 && config->miss_penalty >= 0 &&
+           config->writeback_cost >= 0 && config->mlp > 0 &&
+           config->window >= 0;
+}
+
+amat_model *init_amat(amat_config *config)
+{
+    amat_model *model = alloc_or_die(1, sizeof(amat_model), "AMAT model");
+    model->config = *config;
+    return model;
+}
+
+void amat_access(amat_model *model, int hits, int misses, int writebacks)
+{
+    amat_config *config = &model->config;
+
+    // an M record's miss comes before its store hit
+    for (int i = 0; i < misses; i++) {
+        if (model->group_count > 0 && model->group_count < config->mlp &&
+            model->accesses - model->group_start < (unsigned long) config->window) {
+            model->group_count++;
+            model->overlapped++;
+        } else {
+            model->group_start = model->accesses;
+            model->group_count = 1;
+            model->cycles += config->miss_penalty;
+        }
+        model->accesses++;
+    }
+    model->accesses += hits;
+    model->writebacks += writebacks;
+    model->cycles += (unsigned long) (hits + misses) * config->hit_latency +
+                     (unsigned long) writebacks * config->writeback_cost;
+}
+
+void print_amat_summary(amat_model *model, unsigned long instructions)
+{
+    unsigned long hit_cycles = model->accesses * model->config.hit_latency;
+    unsigned long stall = model->cycles - hit_cycles;
+
+    printf("amat: accesses:%lu overlapped_misses:%lu writebacks:%lu "
+           "cycles:%lu amat:%.2f", model->accesses, model->overlapped,
+           model->writebacks, model->cycles,
+           model->accesses ? (double) model->cycles / model->accesses : 0.0);
+    // stalls are what the accesses cost beyond a hit
+    if (instructions > 0)
+        printf(" stall_cycles_per_kinst:%.1f", stall * 1000.0 / instructions);
+    else
+        printf(" stall_cycles_per_kinst:n/a");
+    printf(" instructions:%lu\n", instructions);
+}
+
+void delete_amat(amat_model *model)
+{
+    free(model);
+}
@@ -0,0 +1,37 @@
+/*
+ * amat.h - Cycle estimate of the simulated memory accesses
+ */
+
+#ifndef CACHELAB_AMAT_H
+#define CACHELAB_AMAT_H
+
+typedef struct {
+    int hit_latency;      // cycles of every access to the cache
+    int miss_penalty;     // extra cycles to fetch a block from the next level
+    int writeback_cost;   // cycles to write a block or store to the next level
+    int mlp;              // most misses outstanding at once
+    int window;           // accesses a miss stays outstanding for
+} amat_config;
+
+typedef struct {
+    amat_config config;
+    unsigned long accesses;
+    unsigned long overlapped;   // misses hidden behind an outstanding one
+    unsigned long writebacks;
+    unsigned long cycles;
+    unsigned long group_start;  // access that opened the outstanding misses
+    int group_count;            // misses outstanding since group_start
+} amat_model;
+
+/* Parse "hit,miss,writeback[,mlp,window]", returns 0 if malformed */
+int parse_amat_config(amat_config *config, const char *spec);
+amat_model *init_amat(amat_config *config);
+/*
+ * amat_access - Charge one simulated access that counted the given
+ *     hits and misses and wrote writebacks blocks to the next level
+ */
+void amat_access(amat_model *model, int hits, int misses, int writebacks);
+void print_amat_summary(amat_model *model, unsigned long instructions);
+void delete_amat(amat_model *model);
+
+#endif /* CACHELAB_AMAT_H */
@@ -0,0 +1,314 @@
+/*
+ * bench.c - Wall-clock and hardware counter benchmark for the registered
+ *     transpose functions.
+ *
+ * Every function in func_list is run on heap allocated matrices at each
+ * requested size, once with warm caches and once with the caches swept
+ * before every run. Where perf_event_open is permitted the L1D and LLC
+ * read misses of each run are collected as well, otherwise only the
+ * timings are reported.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "cachelab.h"
+#include "bench.h"
+
+#define DEFAULT_REPS 5
+#define DEFAULT_FLUSH_BYTES (64L << 20)
+#define MATRIX_ALIGNMENT 64
+
+/* External variables defined in cachelab.c */
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+
+/* Hardware counters that are sampled around each run */
+enum { CTR_L1D, CTR_LLC, NUM_CTRS };
+
+static const char *ctr_names[NUM_CTRS] = {"L1D", "LLC"};
+static int ctr_fds[NUM_CTRS] = {-1, -1};
+
+/*
+ * Written by the cold cache sweep so that the compiler cannot drop it
+ */
+static volatile long flush_sink;
+
+void initBenchOpts(bench_opts_t *opts)
+{
+    opts->reps = DEFAULT_REPS;
+    opts->cpu = 0;
+    opts->num_sizes = 0;
+    opts->flush_bytes = DEFAULT_FLUSH_BYTES;
+}
+
+int parseBenchSizes(bench_opts_t *opts, const char *list)
+{
+    const char *p = list;
+    int m, n, consumed;
+
+    opts->num_sizes = 0;
+    while (*p != '\0') {
+        if (opts->num_sizes == MAX_BENCH_SIZES)
+            return 0;
+        if (sscanf(p, "%dx%d%n", &m, &n, &consumed) != 2 || m <= 0 || n <= 0)
+            return 0;
+        opts->sizes[opts->num_sizes][0] = m;
+        opts->sizes[opts->num_sizes][1] = n;
+        opts->num_sizes++;
+        p += consumed;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            return 0;
+    }
+    return opts->num_sizes > 0;
+}
+
+static int perf_open(unsigned long long config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * open_counters - Try to open the miss counters, returns the number that
+ *     could be opened. The remaining ones are left at -1 and reported as
+ *     unavailable.
+ */
+static int open_counters(void)
+{
+    unsigned long long read_miss =
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    unsigned long long caches[NUM_CTRS] = {
+        PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL
+    };
+    int opened = 0;
+
+    for (int i = 0; i < NUM_CTRS; i++) {
+        ctr_fds[i] = perf_open(caches[i] | read_miss);
+        if (ctr_fds[i] >= 0) {
+            opened++;
+        } else {
+            printf("Note: %s miss counter unavailable (%s), "
+                   "reporting timing only\n", ctr_names[i], strerror(errno));
+        }
+    }
+    return opened;
+}
+
+static void close_counters(void)
+{
+    for (int i = 0; i < NUM_CTRS; i++) {
+        if (ctr_fds[i] >= 0)
+            close(ctr_fds[i]);
+        ctr_fds[i] = -1;
+    }
+}
+
+static void counters_ioctl(unsigned long request)
+{
+    for (int i = 0; i < NUM_CTRS; i++) {
+        if (ctr_fds[i] >= 0)
+            ioctl(ctr_fds[i], request, 0);
+    }
+}
+
+static void read_counters(unsigned long long *values)
+{
+    for (int i = 0; i < NUM_CTRS; i++) {
+        values[i] = 0;
+        if (ctr_fds[i] >= 0 &&
+            read(ctr_fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+            values[i] = 0;
+    }
+}
+
+/*
+ * pin_cpu - Pin to cpu, returns 0 if running unpinned
+ */
+static int pin_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        printf("Note: could not pin to CPU %d (%s), running unpinned\n",
+               cpu, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * flush_caches - Evict the matrices by streaming through a buffer that
+ *     is larger than the last level cache
+ */
+static void flush_caches(long *buf, long words)
+{
+    long sum = 0;
+    for (long i = 0; i < words; i += 8) {
+        buf[i] += 1;
+        sum += buf[i];
+    }
+    flush_sink = sum;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static int check_transpose(int M, int N, int A[N][M], int B[M][N])
+{
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < M; j++) {
+            if (A[i][j] != B[j][i])
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static void *alloc_matrix(size_t bytes)
+{
+    void *p = NULL;
+    if (posix_memalign(&p, MATRIX_ALIGNMENT, bytes) != 0) {
+        fprintf(stderr, "Error allocating %zu byte matrix\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/*
+ * bench_one - Run one function reps times at one size and print a row.
+ *     A function that did not transpose correctly is not timed, its
+ *     bandwidth would be meaningless, and prints "-" instead.
+ */
+static void bench_one(bench_opts_t *opts, int fn, int M, int N,
+                      void *A, void *B, int cold, int correct,
+                      long *flush_buf, int sim_M, int sim_N)
+{
+    trans_func_t *f = &func_list[fn];
+    unsigned long long totals[NUM_CTRS] = {0, 0};
+    unsigned long long values[NUM_CTRS];
+    long flush_words = opts->flush_bytes / sizeof(long);
+    double bytes = 2.0 * M * N * sizeof(int); /* read A, write B */
+    char size[32];
+
+    snprintf(size, sizeof(size), "%dx%d", M, N);
+    if (!correct) {
+        printf("%-4d %11s %-4s %-7s %9s %9s %12s %12s | %9s %9s %9s\n",
+               fn, size, cold ? "cold" : "warm", "no",
+               "-", "-", "-", "-", "-", "-", "-");
+        return;
+    }
+
+    double *times = malloc(sizeof(double) * opts->reps);
+    if (times == NULL) {
+        fprintf(stderr, "Error allocating timing buffer: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (!cold)
+        (*f->func_ptr)(M, N, A, B); /* untimed warm up */
+
+    for (int r = 0; r < opts->reps; r++) {
+        if (cold)
+            flush_caches(flush_buf, flush_words);
+        counters_ioctl(PERF_EVENT_IOC_RESET);
+        counters_ioctl(PERF_EVENT_IOC_ENABLE);
+        double start = now_seconds();
+        (*f->func_ptr)(M, N, A, B);
+        times[r] = now_seconds() - start;
+        counters_ioctl(PERF_EVENT_IOC_DISABLE);
+        read_counters(values);
+        for (int i = 0; i < NUM_CTRS; i++)
+            totals[i] += values[i];
+    }
+    qsort(times, opts->reps, sizeof(double), compare_doubles);
+
+    printf("%-4d %11s %-4s %-7s %9.2f %9.2f",
+           fn, size, cold ? "cold" : "warm", "yes",
+           bytes / times[opts->reps / 2] / 1e9, bytes / times[0] / 1e9);
+    for (int i = 0; i < NUM_CTRS; i++) {
+        if (ctr_fds[i] >= 0)
+            printf(" %12llu", totals[i] / opts->reps);
+        else
+            printf(" %12s", "-");
+    }
+    /* Simulated counts only exist for the size test-trans evaluated */
+    if (M == sim_M && N == sim_N && f->correct) {
+        printf(" | %9u %9u %9u\n",
+               f->num_hits, f->num_misses, f->num_evictions);
+    } else {
+        printf(" | %9s %9s %9s\n", "-", "-", "-");
+    }
+    free(times);
+}
+
+void benchTransFunctions(bench_opts_t *opts, int sim_M, int sim_N)
+{
+    long *flush_buf = malloc(opts->flush_bytes);
+    if (flush_buf == NULL) {
+        fprintf(stderr, "Error allocating cache flush buffer: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset(flush_buf, 0, opts->flush_bytes);
+
+    int pinned = pin_cpu(opts->cpu);
+    open_counters();
+
+    printf("\nBenchmark: %d runs per configuration, ", opts->reps);
+    if (pinned)
+        printf("cpu %d\n", opts->cpu);
+    else
+        printf("unpinned\n");
+    printf("%-4s %11s %-4s %-7s %9s %9s %12s %12s | %9s %9s %9s\n",
+           "func", "size", "mode", "correct", "med GB/s", "best GB/s",
+           "L1D miss", "LLC miss", "sim hits", "sim miss", "sim evict");
+
+    for (int s = 0; s < opts->num_sizes; s++) {
+        int M = opts->sizes[s][0];
+        int N = opts->sizes[s][1];
+        size_t bytes = sizeof(int) * (size_t) M * N;
+        int (*A)[M] = alloc_matrix(bytes);
+        int (*B)[N] = alloc_matrix(bytes);
+
+        initMatrix(M, N, A, B);
+        for (int fn = 0; fn < func_counter; fn++) {
+            memset(B, 0, bytes);
+            (*func_list[fn].func_ptr)(M, N, A, B);
+            int correct = check_transpose(M, N, A, B);
+            for (int cold = 0; cold <= 1; cold++) {
+                bench_one(opts, fn, M, N, A, B, cold, correct,
+                          flush_buf, sim_M, sim_N);
+            }
+        }
+        free(A);
+        free(B);
+    }
+    close_counters();
+    free(flush_buf);
+}
@@ -0,0 +1,31 @@
+/*
+ * bench.h - Prototypes for the wall-clock transpose benchmark
+ */
+
+#ifndef CACHELAB_BENCH_H
+#define CACHELAB_BENCH_H
+
+#define MAX_BENCH_SIZES 16
+
+typedef struct {
+    int reps;                          /* timed runs per configuration */
+    int cpu;                           /* CPU to pin to, -1 leaves it unpinned */
+    int num_sizes;
+    int sizes[MAX_BENCH_SIZES][2];     /* {M, N} pairs to benchmark */
+    long flush_bytes;                  /* size of the cold cache sweep buffer */
+} bench_opts_t;
+
+/* Fill opts with the defaults used by test-trans -B */
+void initBenchOpts(bench_opts_t *opts);
+
+/* Parse a "MxN[,MxN...]" size list into opts, returns 0 on error */
+int parseBenchSizes(bench_opts_t *opts, const char *list);
+
+/*
+ * benchTransFunctions - Time every registered transpose function on real
+ *     memory and print the results next to the simulated counts that
+ *     test-trans stored in func_list for the sim_M x sim_N evaluation.
+ */
+void benchTransFunctions(bench_opts_t *opts, int sim_M, int sim_N);
+
+#endif /* CACHELAB_BENCH_H */
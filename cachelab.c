@@ -1,6 +1,7 @@
 /*
  * cachelab.c - Cache Lab helper functions
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -52,10 +53,22 @@ cache *init_cache(int set_bits_count, int lines_count,
             *(valid_bits + j) = 0;
         }
         (cache_sets_array + i) -> valid_bits = valid_bits;
+        (cache_sets_array + i) -> flags = (unsigned char *) calloc(lines_count, 1);
+        if ((cache_sets_array + i) -> tags == NULL || valid_bits == NULL ||
+            (cache_sets_array + i) -> flags == NULL) {
+            fprintf(stderr, "Error allocating memory for cache lines: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
     }
     new_cache -> sets = cache_sets_array;
     new_cache -> lines_count = lines_count;
     new_cache -> no_of_sets = no_of_sets;
+    new_cache -> lru_clock = 0;
+    new_cache -> write_through = 0;
+    new_cache -> no_write_allocate = 0;
+    new_cache -> dirty_evictions = 0;
+    new_cache -> bytes_read = 0;
+    new_cache -> bytes_written = 0;
     long byte_mask, set_mask;
     byte_mask = set_mask = 0;
     int byte_mask_length, set_mask_length;
@@ -85,6 +98,7 @@ void delete_cache(cache *cache)
     for (int i = 0; i < no_of_sets; i++) {
         free((sets + i) -> tags);
         free((sets + i) -> valid_bits);
+        free((sets + i) -> flags);
     }
     free(sets);
     free(cache);
@@ -95,8 +109,8 @@ void update_counts(cache *instance_cache, long address, char op,
     // int needed_byte = address & (instance_cache -> byte_mask);
     int needed_set = ((address >> (instance_cache -> byte_mask_length)) &
                       (instance_cache -> set_mask)); // index into array of sets
-    int needed_tag = ((address >> (instance_cache -> byte_mask_length)) >>
-                      (instance_cache -> set_mask_length));
+    long needed_tag = ((address >> (instance_cache -> byte_mask_length)) >>
+                       (instance_cache -> set_mask_length));
     // retrieve particular set from cache
     cache_set *target_set = (instance_cache -> sets) + needed_set;
     long *tags = target_set -> tags;
@@ -157,6 +171,121 @@ void update_counts(cache *instance_cache, long address, char op,
     *(valid_bits + line_index) = max_valid_bit + 1; // increase LRU
 }
 
+cache_set *cache_set_of(cache *instance_cache, long address)
+{
+    long needed_set = ((address >> (instance_cache -> byte_mask_length)) &
+                       (instance_cache -> set_mask));
+    return (instance_cache -> sets) + needed_set;
+}
+
+int cache_lookup(cache *instance_cache, long address)
+{
+    long needed_tag = ((address >> (instance_cache -> byte_mask_length)) >>
+                       (instance_cache -> set_mask_length));
+    cache_set *target_set = cache_set_of(instance_cache, address);
+    long *tags = target_set -> tags;
+    unsigned long *valid_bits = target_set -> valid_bits;
+    int lines_count = instance_cache -> lines_count;
+
+    for (int i = 0; i < lines_count; i++) {
+        if (*(valid_bits + i) && *(tags + i) == needed_tag) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void cache_touch(cache *instance_cache, long address, int line)
+{
+    // a cache wide clock orders the lines of a set exactly like
+    // the max + 1 scheme in update_counts without scanning the set
+    cache_set *target_set = cache_set_of(instance_cache, address);
+    *(target_set -> valid_bits + line) = ++(instance_cache -> lru_clock);
+}
+
+int cache_fill(cache *instance_cache, long address, int *line,
+               long *victim_address, unsigned char *victim_flags)
+{
+    int shift = instance_cache -> byte_mask_length +
+                instance_cache -> set_mask_length;
+    cache_set *target_set = cache_set_of(instance_cache, address);
+    unsigned long *valid_bits = target_set -> valid_bits;
+    int lines_count = instance_cache -> lines_count;
+    long block_size = 1L << (instance_cache -> byte_mask_length);
+    int least_used_index = 0;
+    int evicted = 0;
+
+    for (int i = 1; i < lines_count; i++) {
+        if (*(valid_bits + i) < *(valid_bits + least_used_index)) {
+            least_used_index = i;
+        }
+    }
+    if (*(valid_bits + least_used_index) != 0) {
+        // rebuild the block address of the line being replaced
+        long set_bits = address & ((instance_cache -> set_mask) <<
+                                   (instance_cache -> byte_mask_length));
+        *victim_address = (*(target_set -> tags + least_used_index) << shift) |
+                          set_bits;
+        *victim_flags = *(target_set -> flags + least_used_index);
+        evicted = 1;
+        if (*victim_flags & LINE_DIRTY) {
+            instance_cache -> dirty_evictions++;
+            instance_cache -> bytes_written += block_size;
+        }
+    }
+    instance_cache -> bytes_read += block_size;
+    *(target_set -> tags + least_used_index) = address >> shift;
+    *(target_set -> flags + least_used_index) = 0;
+    cache_touch(instance_cache, address, least_used_index);
+    *line = least_used_index;
+    return evicted;
+}
+
+void cache_invalidate(cache *instance_cache, long address, int line)
+{
+    cache_set *target_set = cache_set_of(instance_cache, address);
+    *(target_set -> valid_bits + line) = 0;
+    *(target_set -> flags + line) = 0;
+}
+
+void cache_store(cache *instance_cache, long address, int line, int size)
+{
+    if (instance_cache -> write_through) {
+        instance_cache -> bytes_written += size;
+    } else {
+        *(cache_set_of(instance_cache, address) -> flags + line) |= LINE_DIRTY;
+    }
+}
+
+void policy_update_counts(cache *instance_cache, long address, char op,
+                          int size, int *hits, int *misses, int *evictions)
+{
+    int line = cache_lookup(instance_cache, address);
+    long victim;
+    unsigned char victim_flags;
+
+    if (line != -1) {
+        *hits = *hits + 1;
+        cache_touch(instance_cache, address, line);
+    } else {
+        *misses = *misses + 1;
+        if (op == 'S' && instance_cache -> no_write_allocate) {
+            // the store goes around the cache
+            instance_cache -> bytes_written += size;
+            return;
+        }
+        if (cache_fill(instance_cache, address, &line, &victim, &victim_flags)) {
+            *evictions = *evictions + 1;
+        }
+    }
+    if (op == 'M') {
+        *hits = *hits + 1;
+    }
+    if (op != 'L') {
+        cache_store(instance_cache, address, line, size);
+    }
+}
+
 /*
  * initMatrix - Initialize the given matrix
  */
@@ -215,3 +344,100 @@ void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
     func_list[func_counter].num_evictions =0;
     func_counter++;
 }
+
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *alloc_or_die(size_t count, size_t size, const char *what)
+{
+    void *p = calloc(count, size);
+    if (p == NULL) {
+        fprintf(stderr, "Error allocating %s: %s\n", what, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void block_table_init(block_table *table, size_t entry_size,
+                      unsigned long size)
+{
+    table->entry_size = entry_size;
+    table->size = size;
+    table->used = 0;
+    table->slots = alloc_or_die(size, entry_size, "block table");
+}
+
+static inline unsigned long slot_key(block_table *table, unsigned long i)
+{
+    return *(unsigned long *) block_table_slot(table, i);
+}
+
+void *block_table_find(block_table *table, unsigned long block)
+{
+    unsigned long key = block + 1;
+    unsigned long mask = table->size - 1;
+    unsigned long i = hash_block(key) & mask;
+
+    while (slot_key(table, i) != 0) {
+        if (slot_key(table, i) == key)
+            return block_table_slot(table, i);
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+static void block_table_grow(block_table *table)
+{
+    block_table old = *table;
+
+    block_table_init(table, old.entry_size, old.size * 2);
+    table->used = old.used;
+    for (unsigned long j = 0; j < old.size; j++) {
+        unsigned long key = slot_key(&old, j);
+        if (key == 0)
+            continue;
+        unsigned long i = hash_block(key) & (table->size - 1);
+        while (slot_key(table, i) != 0)
+            i = (i + 1) & (table->size - 1);
+        memcpy(block_table_slot(table, i), block_table_slot(&old, j),
+               table->entry_size);
+    }
+    free(old.slots);
+}
+
+void *block_table_insert(block_table *table, unsigned long block, int *added)
+{
+    unsigned long key = block + 1;
+    unsigned long mask = table->size - 1;
+    unsigned long i = hash_block(key) & mask;
+
+    while (slot_key(table, i) != 0) {
+        if (slot_key(table, i) == key) {
+            if (added != NULL)
+                *added = 0;
+            return block_table_slot(table, i);
+        }
+        i = (i + 1) & mask;
+    }
+    if ((table->used + 1) * 4 > table->size * 3) {
+        block_table_grow(table);
+        mask = table->size - 1;
+        i = hash_block(key) & mask;
+        while (slot_key(table, i) != 0)
+            i = (i + 1) & mask;
+    }
+    *(unsigned long *) block_table_slot(table, i) = key;
+    table->used++;
+    if (added != NULL)
+        *added = 1;
+    return block_table_slot(table, i);
+}
+
+void block_table_free(block_table *table)
+{
+    free(table->slots);
+}
@@ -5,6 +5,8 @@
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
+#include <stddef.h>
+
 #define MAX_TRANS_FUNCS 100
 
 typedef struct trans_func{
@@ -37,6 +39,7 @@ void registerTransFunction(
 typedef struct {
     long *tags;
     unsigned long *valid_bits; // will be used for LRU policing
+    unsigned char *flags; // per line state bits, see LINE_* below
 } cache_set;
 
 typedef struct {
@@ -47,12 +50,88 @@ typedef struct {
     long set_mask;
     int byte_mask_length;
     int set_mask_length;
+    unsigned long lru_clock; // last LRU value handed out by cache_touch
+    int write_through;       // stores are passed on to the next level
+    int no_write_allocate;   // store misses do not bring the block in
+    unsigned long dirty_evictions;
+    unsigned long bytes_read;     // traffic from the next level
+    unsigned long bytes_written;  // traffic to the next level
 } cache;
 
+/* Bits kept in cache_set.flags, the low bits hold a coherence state */
+#define LINE_STATE_MASK 0x07
+#define LINE_WATCHED    0x08 // block has cores waiting on a coherence miss
+#define LINE_PREFETCHED 0x10 // brought in by a prefetch, not yet used
+#define LINE_DIRTY      0x20 // written since it was filled, write-back only
+
 cache *init_cache(int set_bits_count,
                   int lines_count, int byte_bits_count);
 void update_counts(cache *instance_cache, long address, char op,
                    int *hits, int *misses, int *evictions);
 void delete_cache(cache *cache_pointer);
 
+/*
+ * Line level access for simulators that need more than hit/miss counts.
+ * cache_lookup returns the line holding address in its set or -1,
+ * cache_fill installs address over the LRU line and reports the block
+ * address and flags of a valid victim, returning 1 if there was one.
+ */
+cache_set *cache_set_of(cache *instance_cache, long address);
+int cache_lookup(cache *instance_cache, long address);
+void cache_touch(cache *instance_cache, long address, int line);
+int cache_fill(cache *instance_cache, long address, int *line,
+               long *victim_address, unsigned char *victim_flags);
+void cache_invalidate(cache *instance_cache, long address, int line);
+void cache_store(cache *instance_cache, long address, int line, int size);
+
+/*
+ * policy_update_counts - update_counts honouring the cache's write
+ *     policy and keeping its dirty eviction and traffic counters
+ */
+void policy_update_counts(cache *instance_cache, long address, char op,
+                          int size, int *hits, int *misses, int *evictions);
+
+/* now_seconds - Read the monotonic clock */
+double now_seconds(void);
+
+/*
+ * alloc_or_die - Zeroed memory for count objects of size bytes, exits
+ *     naming what could not be allocated
+ */
+void *alloc_or_die(size_t count, size_t size, const char *what);
+
+/*
+ * Open addressing hash table with linear probing keyed on block number,
+ * for per block state. Every entry is entry_size bytes and starts with
+ * an unsigned long key holding block + 1, 0 marks an empty slot. The
+ * table doubles once three quarters full, so entry pointers are only
+ * valid until the next block_table_insert.
+ */
+typedef struct {
+    char *slots;
+    size_t entry_size;
+    unsigned long size;     // always a power of two
+    unsigned long used;
+} block_table;
+
+static inline unsigned long hash_block(unsigned long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    return key;
+}
+
+static inline void *block_table_slot(block_table *table, unsigned long i)
+{
+    return table->slots + i * table->entry_size;
+}
+
+void block_table_init(block_table *table, size_t entry_size,
+                      unsigned long size);
+void *block_table_find(block_table *table, unsigned long block);
+/* Entry of block, a zeroed one if new. *added, if given, tells which. */
+void *block_table_insert(block_table *table, unsigned long block, int *added);
+void block_table_free(block_table *table);
+
 #endif /* CACHELAB_TOOLS_H */
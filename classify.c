@@ -0,0 +1,240 @@
+/*
+ * classify.c - 3C miss classification
+ *
+ * A miss on a block that is not yet in the first-touch set of all blocks
+ * seen is compulsory. Every other miss is looked up in a fully
+ * associative LRU cache with as many lines as the real one: if that
+ * shadow missed as well the miss is a capacity miss, otherwise it is a
+ * conflict miss.
+ *
+ * Both structures are O(1) per access. The first-touch set is an open
+ * addressing hash set that doubles as it fills. Every demand access goes
+ * into it, hits included, so a block first brought in by a prefetcher is
+ * not compulsory when it misses later. The shadow cache is a fixed size
+ * hash map from block to a node of a doubly linked LRU list, kept in
+ * index arrays instead of pointers so 32 bits per link suffice.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cachelab.h"
+#include "classify.h"
+
+#define INITIAL_SET_SIZE (1UL << 16)
+#define NO_NODE 0xffffffffU
+
+typedef struct {
+    unsigned long *keys;    // block number + 1, 0 marks an empty slot
+    unsigned int *slot_node;
+    unsigned long mask;
+    unsigned long *node_key;
+    unsigned int *prev;
+    unsigned int *next;
+    unsigned int head;      // most recently used node
+    unsigned int tail;      // least recently used node
+    unsigned int count;
+    unsigned int capacity;
+} shadow_lru;
+
+typedef struct {
+    unsigned long compulsory;
+    unsigned long capacity;
+    unsigned long conflict;
+} miss_classes;
+
+struct classifier {
+    int byte_bits;
+    block_table seen;       // keys only, the first-touch set
+    shadow_lru shadow;
+    miss_classes total;
+    miss_classes window;    // counts since the last interval line
+    unsigned long accesses;
+    unsigned long interval;
+    unsigned long next_report; // access count of the next interval line
+};
+
+static void shadow_init(shadow_lru *shadow, unsigned int capacity)
+{
+    unsigned long slots = 2;
+    while (slots < 2UL * capacity)
+        slots <<= 1;
+    shadow->keys = alloc_or_die(slots, sizeof(unsigned long),
+                                "miss classifier");
+    shadow->slot_node = alloc_or_die(slots, sizeof(unsigned int),
+                                     "miss classifier");
+    shadow->mask = slots - 1;
+    shadow->node_key = alloc_or_die(capacity, sizeof(unsigned long),
+                                    "miss classifier");
+    shadow->prev = alloc_or_die(capacity, sizeof(unsigned int),
+                                "miss classifier");
+    shadow->next = alloc_or_die(capacity, sizeof(unsigned int),
+                                "miss classifier");
+    shadow->head = shadow->tail = NO_NODE;
+    shadow->count = 0;
+    shadow->capacity = capacity;
+}
+
+static void shadow_unlink(shadow_lru *shadow, unsigned int node)
+{
+    unsigned int prev = shadow->prev[node];
+    unsigned int next = shadow->next[node];
+
+    if (prev != NO_NODE)
+        shadow->next[prev] = next;
+    else
+        shadow->head = next;
+    if (next != NO_NODE)
+        shadow->prev[next] = prev;
+    else
+        shadow->tail = prev;
+}
+
+static void shadow_push_front(shadow_lru *shadow, unsigned int node)
+{
+    shadow->prev[node] = NO_NODE;
+    shadow->next[node] = shadow->head;
+    if (shadow->head != NO_NODE)
+        shadow->prev[shadow->head] = node;
+    else
+        shadow->tail = node;
+    shadow->head = node;
+}
+
+/*
+ * shadow_remove - Delete key from the map, shifting later entries of the
+ *     probe sequence back so that no tombstones are needed
+ */
+static void shadow_remove(shadow_lru *shadow, unsigned long key)
+{
+    unsigned long mask = shadow->mask;
+    unsigned long i = hash_block(key) & mask;
+
+    while (shadow->keys[i] != key)
+        i = (i + 1) & mask;
+    for (;;) {
+        unsigned long j = i;
+        shadow->keys[i] = 0;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (shadow->keys[j] == 0)
+                return;
+            unsigned long home = hash_block(shadow->keys[j]) & mask;
+            // entries whose home lies cyclically in (i, j] stay put
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+                continue;
+            shadow->keys[i] = shadow->keys[j];
+            shadow->slot_node[i] = shadow->slot_node[j];
+            i = j;
+            break;
+        }
+    }
+}
+
+/*
+ * shadow_access - Access key in the fully associative LRU cache,
+ *     returns 1 on a hit
+ */
+static int shadow_access(shadow_lru *shadow, unsigned long key)
+{
+    unsigned long mask = shadow->mask;
+    unsigned long i = hash_block(key) & mask;
+    unsigned int node;
+
+    while (shadow->keys[i] != 0) {
+        if (shadow->keys[i] == key) {
+            node = shadow->slot_node[i];
+            if (node != shadow->head) {
+                shadow_unlink(shadow, node);
+                shadow_push_front(shadow, node);
+            }
+            return 1;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (shadow->count < shadow->capacity) {
+        node = shadow->count++;
+    } else {
+        node = shadow->tail;
+        shadow_unlink(shadow, node);
+        shadow_remove(shadow, shadow->node_key[node]);
+        // the removal may have shifted the free slot we found
+        i = hash_block(key) & mask;
+        while (shadow->keys[i] != 0)
+            i = (i + 1) & mask;
+    }
+    shadow->keys[i] = key;
+    shadow->slot_node[i] = node;
+    shadow->node_key[node] = key;
+    shadow_push_front(shadow, node);
+    return 0;
+}
+
+classifier *init_classifier(cache *instance_cache, unsigned long interval)
+{
+    classifier *cl = alloc_or_die(1, sizeof(classifier), "miss classifier");
+    cl->byte_bits = instance_cache->byte_mask_length;
+    cl->interval = interval;
+    cl->next_report = interval; // 0 never matches after the first access
+    block_table_init(&cl->seen, sizeof(unsigned long), INITIAL_SET_SIZE);
+    shadow_init(&cl->shadow, instance_cache->no_of_sets *
+                             instance_cache->lines_count);
+    return cl;
+}
+
+static void fold_window(classifier *cl)
+{
+    cl->total.compulsory += cl->window.compulsory;
+    cl->total.capacity += cl->window.capacity;
+    cl->total.conflict += cl->window.conflict;
+    memset(&cl->window, 0, sizeof(cl->window));
+}
+
+static void print_classes(const char *label, miss_classes *classes)
+{
+    printf("%s: compulsory:%lu capacity:%lu conflict:%lu\n", label,
+           classes->compulsory, classes->capacity, classes->conflict);
+}
+
+void classify_access(classifier *cl, unsigned long address, int missed)
+{
+    unsigned long block = address >> cl->byte_bits;
+    int shadow_hit = shadow_access(&cl->shadow, block + 1);
+    int first_touch;
+
+    block_table_insert(&cl->seen, block, &first_touch);
+
+    if (missed) {
+        if (first_touch)
+            cl->window.compulsory++;
+        else if (!shadow_hit)
+            cl->window.capacity++;
+        else
+            cl->window.conflict++;
+    }
+    if (++cl->accesses == cl->next_report) {
+        char label[64];
+        snprintf(label, sizeof(label), "3c interval %lu",
+                 cl->accesses / cl->interval);
+        print_classes(label, &cl->window);
+        fold_window(cl);
+        cl->next_report += cl->interval;
+    }
+}
+
+void print_classify_summary(classifier *cl)
+{
+    fold_window(cl);
+    print_classes("3c", &cl->total);
+}
+
+void delete_classifier(classifier *cl)
+{
+    block_table_free(&cl->seen);
+    free(cl->shadow.keys);
+    free(cl->shadow.slot_node);
+    free(cl->shadow.node_key);
+    free(cl->shadow.prev);
+    free(cl->shadow.next);
+    free(cl);
+}
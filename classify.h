@@ -0,0 +1,23 @@
+/*
+ * classify.h - Compulsory/capacity/conflict classification of misses
+ */
+
+#ifndef CACHELAB_CLASSIFY_H
+#define CACHELAB_CLASSIFY_H
+
+#include "cachelab.h"
+
+typedef struct classifier classifier;
+
+/*
+ * init_classifier - Shadow the given cache. With interval > 0 a line
+ *     with the counts of the last interval accesses is printed as the
+ *     simulation goes.
+ */
+classifier *init_classifier(cache *instance_cache, unsigned long interval);
+/* Feed one demand access to a single block and whether the cache missed */
+void classify_access(classifier *cl, unsigned long address, int missed);
+void print_classify_summary(classifier *cl);
+void delete_classifier(classifier *cl);
+
+#endif /* CACHELAB_CLASSIFY_H */
@@ -0,0 +1,565 @@
+/*
+ * coherence.c - MESI/MOESI simulation over per-core private caches
+ *
+ * Each core gets its own cache built by init_cache, with the coherence
+ * state of every line kept in the low bits of cache_set.flags. A table
+ * with one entry per block ever touched holds the sharer vector used by
+ * the directory model, together with the bookkeeping that classifies
+ * coherence misses and false sharing:
+ *
+ *   - a core whose copy is invalidated is remembered in the block's
+ *     invalidated vector until it misses on the block again, and that
+ *     miss is a coherence miss
+ *   - while it waits, every byte other cores write to the block is
+ *     or'ed into its written mask. If the access that misses touches
+ *     none of those bytes the miss was caused by false sharing
+ *
+ * Reads that hit never touch the table, and writes that hit only do so
+ * when the line is LINE_WATCHED, i.e. some core is waiting on the block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "cachelab.h"
+#include "coherence.h"
+
+#define BUFF_SIZE 1024
+#define STREAM_BUFF_SIZE (1 << 20)
+#define INITIAL_TABLE_SIZE (1 << 16)
+#define TOP_BLOCKS 10
+
+/* Line states stored under LINE_STATE_MASK, 0 is invalid */
+enum { STATE_I, STATE_S, STATE_E, STATE_O, STATE_M };
+
+static const char state_is_dirty[] = {0, 0, 0, 1, 1};
+
+typedef struct {
+    unsigned long key;      // block number + 1, 0 marks an empty slot
+    uint64_t sharers;       // cores holding a valid copy
+    uint64_t invalidated;   // cores waiting to refetch an invalidated copy
+    uint64_t *written;      // per core bytes written since its invalidation
+    unsigned long invalidations;
+    unsigned long coherence_misses;
+    unsigned long false_sharing;
+} block_entry;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;    // copies this core lost to other writers
+    unsigned long coherence_misses;
+    unsigned long false_sharing;
+    unsigned long writebacks;
+    unsigned long upgrades;         // S/O to M without refetching data
+} core_stats;
+
+typedef struct {
+    coherence_config *config;
+    cache *caches[MAX_CORES];
+    core_stats stats[MAX_CORES];
+    cache *llc;
+    unsigned long llc_hits, llc_misses, llc_evictions;
+    block_table table;
+    int granule_shift;              // bytes per written mask bit, as a shift
+    unsigned long messages;         // bus transactions or directory messages
+    unsigned long snoop_lookups;
+    unsigned long transfers;        // cache to cache data transfers
+    unsigned long memory_reads;
+} coherence_sim;
+
+typedef struct {
+    FILE *f_stream;
+    char *stream_buffer;
+    int active;
+} trace_reader;
+
+/* Free the block table along with every entry's written masks */
+static void table_free(block_table *table)
+{
+    for (unsigned long i = 0; i < table->size; i++)
+        free(((block_entry *) block_table_slot(table, i))->written);
+    block_table_free(table);
+}
+
+/*
+ * access_mask - Bits of the written mask covered by an access
+ */
+static uint64_t access_mask(coherence_sim *sim, unsigned long address, int size)
+{
+    long block_bytes = 1L << sim->config->byte_bits_count;
+    long offset = address & (block_bytes - 1);
+    long end = offset + (size > 0 ? size : 1) - 1;
+
+    if (end >= block_bytes)
+        end = block_bytes - 1;
+    int first = offset >> sim->granule_shift;
+    int last = end >> sim->granule_shift;
+    uint64_t upto_last = last == 63 ? ~0ULL : (1ULL << (last + 1)) - 1;
+    return upto_last & ~((1ULL << first) - 1);
+}
+
+static unsigned char *line_flags(cache *c, unsigned long address, int line)
+{
+    return cache_set_of(c, address)->flags + line;
+}
+
+static void set_state(unsigned char *flags, int state)
+{
+    *flags = (*flags & ~LINE_STATE_MASK) | state;
+}
+
+/*
+ * remote_sharers - Cores other than core that hold a copy of the block.
+ *     The snooping model asks every cache, the directory uses the vector.
+ */
+static uint64_t remote_sharers(coherence_sim *sim, block_entry *entry,
+                               int core, unsigned long address)
+{
+    uint64_t others = 0;
+
+    sim->messages++;
+    if (sim->config->model == MODEL_DIRECTORY) {
+        others = entry->sharers & ~(1ULL << core);
+        // one forward or invalidate plus one reply per sharer
+        sim->messages += 2 * __builtin_popcountll(others);
+        return others;
+    }
+    for (int o = 0; o < sim->config->cores; o++) {
+        if (o == core || sim->caches[o] == NULL)
+            continue;
+        sim->snoop_lookups++;
+        if (cache_lookup(sim->caches[o], address) >= 0)
+            others |= 1ULL << o;
+    }
+    return others;
+}
+
+/*
+ * record_write - Add the written bytes to every core waiting on the block
+ */
+static void record_write(block_entry *entry, int core, uint64_t mask)
+{
+    uint64_t waiting = entry->invalidated & ~(1ULL << core);
+    while (waiting) {
+        int p = __builtin_ctzll(waiting);
+        entry->written[p] |= mask;
+        waiting &= waiting - 1;
+    }
+}
+
+/*
+ * invalidate_others - Remove every remote copy ahead of a write.
+ *     Returns 1 if one of them was dirty and supplied the data.
+ */
+static int invalidate_others(coherence_sim *sim, block_entry *entry,
+                             int core, unsigned long address)
+{
+    uint64_t others = remote_sharers(sim, entry, core, address);
+    int supplied = 0;
+
+    if (others && entry->written == NULL) {
+        entry->written = alloc_or_die(sim->config->cores, sizeof(uint64_t),
+                                      "written masks");
+    }
+    while (others) {
+        int o = __builtin_ctzll(others);
+        cache *c = sim->caches[o];
+        int line = cache_lookup(c, address);
+        int state = *line_flags(c, address, line) & LINE_STATE_MASK;
+
+        if (state_is_dirty[state])
+            supplied = 1; // ownership and dirty data move to the writer
+        cache_invalidate(c, address, line);
+        sim->stats[o].invalidations++;
+        entry->invalidations++;
+        entry->sharers &= ~(1ULL << o);
+        entry->invalidated |= 1ULL << o;
+        entry->written[o] = 0;
+        others &= others - 1;
+    }
+    if (supplied)
+        sim->transfers++;
+    return supplied;
+}
+
+/*
+ * share_with_others - Downgrade remote copies ahead of a read. Returns 1
+ *     if a remote cache supplied the data, *shared tells whether any
+ *     remote copy remains.
+ */
+static int share_with_others(coherence_sim *sim, block_entry *entry,
+                             int core, unsigned long address, int *shared)
+{
+    uint64_t others = remote_sharers(sim, entry, core, address);
+    int supplied = 0;
+
+    *shared = others != 0;
+    while (others) {
+        int o = __builtin_ctzll(others);
+        cache *c = sim->caches[o];
+        int line = cache_lookup(c, address);
+        unsigned char *flags = line_flags(c, address, line);
+
+        switch (*flags & LINE_STATE_MASK) {
+        case STATE_M:
+            if (sim->config->protocol == PROTOCOL_MOESI) {
+                set_state(flags, STATE_O); // keep the dirty data on chip
+            } else {
+                set_state(flags, STATE_S);
+                sim->stats[o].writebacks++;
+            }
+            supplied = 1;
+            break;
+        case STATE_E:
+            set_state(flags, STATE_S);
+            supplied = 1;
+            break;
+        case STATE_O:
+            supplied = 1;
+            break;
+        }
+        others &= others - 1;
+    }
+    if (supplied)
+        sim->transfers++;
+    return supplied;
+}
+
+static void core_miss(coherence_sim *sim, int core, unsigned long address,
+                      int size, int write)
+{
+    cache *c = sim->caches[core];
+    core_stats *stats = &sim->stats[core];
+    unsigned long block = address >> sim->config->byte_bits_count;
+    uint64_t bit = 1ULL << core;
+    uint64_t mask = access_mask(sim, address, size);
+    block_entry *entry = block_table_insert(&sim->table, block, NULL);
+    int supplied, shared, state, line;
+    long victim;
+    unsigned char victim_flags;
+
+    stats->misses++;
+    if (entry->invalidated & bit) {
+        stats->coherence_misses++;
+        entry->coherence_misses++;
+        if ((entry->written[core] & mask) == 0) {
+            stats->false_sharing++;
+            entry->false_sharing++;
+        }
+        entry->invalidated &= ~bit;
+    }
+
+    if (write) {
+        supplied = invalidate_others(sim, entry, core, address);
+        state = STATE_M;
+    } else {
+        supplied = share_with_others(sim, entry, core, address, &shared);
+        state = shared ? STATE_S : STATE_E;
+    }
+    if (!supplied) {
+        sim->memory_reads++;
+        if (sim->llc != NULL) {
+            int llc_hits = 0, llc_misses = 0, llc_evictions = 0;
+            update_counts(sim->llc, address, 'L', &llc_hits,
+                          &llc_misses, &llc_evictions);
+            sim->llc_hits += llc_hits;
+            sim->llc_misses += llc_misses;
+            sim->llc_evictions += llc_evictions;
+        }
+    }
+
+    if (cache_fill(c, address, &line, &victim, &victim_flags)) {
+        stats->evictions++;
+        if (state_is_dirty[victim_flags & LINE_STATE_MASK])
+            stats->writebacks++;
+        // the victim is always in the table, so entry stays valid
+        block_entry *victim_entry = block_table_find(&sim->table,
+            (unsigned long) victim >> sim->config->byte_bits_count);
+        victim_entry->sharers &= ~bit;
+        if (sim->config->model == MODEL_DIRECTORY)
+            sim->messages++; // replacement notice
+    }
+    entry->sharers |= bit;
+    *line_flags(c, address, line) = state |
+        (entry->invalidated ? LINE_WATCHED : 0);
+    if (write)
+        record_write(entry, core, mask);
+}
+
+static void core_access(coherence_sim *sim, int core, unsigned long address,
+                        int size, int write)
+{
+    cache *c = sim->caches[core];
+    int line = cache_lookup(c, address);
+
+    if (line < 0) {
+        core_miss(sim, core, address, size, write);
+        return;
+    }
+    sim->stats[core].hits++;
+    cache_touch(c, address, line);
+    if (!write)
+        return;
+
+    unsigned char *flags = line_flags(c, address, line);
+    unsigned long block = address >> sim->config->byte_bits_count;
+    block_entry *entry;
+    switch (*flags & LINE_STATE_MASK) {
+    case STATE_E:
+        set_state(flags, STATE_M);
+        /* fall through */
+    case STATE_M:
+        if (*flags & LINE_WATCHED) {
+            entry = block_table_find(&sim->table, block);
+            record_write(entry, core, access_mask(sim, address, size));
+        }
+        break;
+    default:
+        // S or O, the other copies must go before writing
+        sim->stats[core].upgrades++;
+        entry = block_table_find(&sim->table, block);
+        invalidate_others(sim, entry, core, address);
+        *flags = STATE_M | (entry->invalidated ? LINE_WATCHED : 0);
+        record_write(entry, core, access_mask(sim, address, size));
+        break;
+    }
+}
+
+/*
+ * parse_access - Decode " L 10,4 [tid]". Returns 0 for instruction
+ *     records and lines that are not data accesses.
+ */
+static int parse_access(const char *p, char *op, unsigned long *address,
+                        int *size, int *tid)
+{
+    unsigned long value = 0;
+    int n = 0;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    *op = *p++;
+    if (*op != 'L' && *op != 'S' && *op != 'M')
+        return 0;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    for (;; p++) {
+        if (*p >= '0' && *p <= '9')
+            value = (value << 4) | (*p - '0');
+        else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+            value = (value << 4) | ((*p | 0x20) - 'a' + 10);
+        else
+            break;
+    }
+    *address = value;
+    if (*p == ',') {
+        for (p++; *p >= '0' && *p <= '9'; p++)
+            n = n * 10 + (*p - '0');
+    }
+    *size = n;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p >= '0' && *p <= '9') {
+        for (n = 0; *p >= '0' && *p <= '9'; p++)
+            n = n * 10 + (*p - '0');
+        *tid = n;
+    } else {
+        *tid = -1;
+    }
+    return 1;
+}
+
+static void open_reader(trace_reader *reader, char *trace_name)
+{
+    reader->f_stream = fopen(trace_name, "r");
+    if (reader->f_stream == NULL) {
+        fprintf(stderr, "Could not open file (%s): %s\n", trace_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    reader->stream_buffer = malloc(STREAM_BUFF_SIZE);
+    if (reader->stream_buffer != NULL)
+        setvbuf(reader->f_stream, reader->stream_buffer, _IOFBF, STREAM_BUFF_SIZE);
+    reader->active = 1;
+}
+
+static void close_reader(trace_reader *reader)
+{
+    fclose(reader->f_stream);
+    free(reader->stream_buffer);
+}
+
+static void simulate(coherence_sim *sim, int core, char op,
+                     unsigned long address, int size)
+{
+    if (sim->caches[core] == NULL) {
+        coherence_config *config = sim->config;
+        sim->caches[core] = init_cache(config->set_bits_count,
+                                       config->lines_count,
+                                       config->byte_bits_count);
+    }
+    // a modify is a load followed by a store, like update_counts
+    core_access(sim, core, address, size, op == 'S');
+    if (op == 'M')
+        core_access(sim, core, address, size, 1);
+}
+
+static void run_traces(coherence_sim *sim, char **trace_names, int trace_count)
+{
+    trace_reader readers[MAX_CORES];
+    char *buffer = malloc(BUFF_SIZE);
+    unsigned long address;
+    int size, tid, active = trace_count;
+    char op;
+
+    if (buffer == NULL) {
+        fprintf(stderr, "Error allocating line buffer: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < trace_count; i++)
+        open_reader(&readers[i], trace_names[i]);
+
+    if (trace_count == 1) {
+        // one trace tagged with thread ids
+        while (fgets(buffer, BUFF_SIZE, readers[0].f_stream) != NULL) {
+            if (!parse_access(buffer, &op, &address, &size, &tid))
+                continue;
+            if (tid < 0)
+                tid = 0;
+            if (tid >= sim->config->cores) {
+                fprintf(stderr, "Thread id %d in trace exceeds %d cores\n",
+                        tid, sim->config->cores);
+                exit(EXIT_FAILURE);
+            }
+            simulate(sim, tid, op, address, size);
+        }
+    } else {
+        // one trace per core, one access from each in turn
+        while (active > 0) {
+            for (int core = 0; core < trace_count; core++) {
+                trace_reader *reader = &readers[core];
+                int found = 0;
+                while (reader->active && !found) {
+                    if (fgets(buffer, BUFF_SIZE, reader->f_stream) == NULL) {
+                        reader->active = 0;
+                        active--;
+                    } else {
+                        found = parse_access(buffer, &op, &address, &size, &tid);
+                    }
+                }
+                if (found)
+                    simulate(sim, core, op, address, size);
+            }
+        }
+    }
+    for (int i = 0; i < trace_count; i++)
+        close_reader(&readers[i]);
+    free(buffer);
+}
+
+/*
+ * print_top_blocks - Report the blocks with the most false sharing,
+ *     ties broken by invalidations
+ */
+static void print_top_blocks(coherence_sim *sim)
+{
+    block_entry *top[TOP_BLOCKS];
+    int count = 0;
+
+    for (unsigned long i = 0; i < sim->table.size; i++) {
+        block_entry *entry = block_table_slot(&sim->table, i);
+        if (entry->key == 0 || entry->invalidations == 0)
+            continue;
+        int pos = count < TOP_BLOCKS ? count : TOP_BLOCKS;
+        while (pos > 0 &&
+               (top[pos - 1]->false_sharing < entry->false_sharing ||
+                (top[pos - 1]->false_sharing == entry->false_sharing &&
+                 top[pos - 1]->invalidations < entry->invalidations))) {
+            if (pos < TOP_BLOCKS)
+                top[pos] = top[pos - 1];
+            pos--;
+        }
+        if (pos < TOP_BLOCKS) {
+            top[pos] = entry;
+            if (count < TOP_BLOCKS)
+                count++;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        printf("block 0x%lx: invalidations:%lu coherence_misses:%lu "
+               "false_sharing:%lu\n",
+               (top[i]->key - 1) << sim->config->byte_bits_count,
+               top[i]->invalidations, top[i]->coherence_misses,
+               top[i]->false_sharing);
+    }
+}
+
+/*
+ * print_totals - printSummary for counts summed over all cores, which
+ *     can pass INT_MAX on big combined traces
+ */
+static void print_totals(unsigned long hits, unsigned long misses,
+                         unsigned long evictions)
+{
+    printf("hits:%lu misses:%lu evictions:%lu\n", hits, misses, evictions);
+    FILE *output_fp = fopen(".csim_results", "w");
+    if (output_fp == NULL) {
+        fprintf(stderr, "Could not write .csim_results: %s\n", strerror(errno));
+        return;
+    }
+    fprintf(output_fp, "%lu %lu %lu\n", hits, misses, evictions);
+    fclose(output_fp);
+}
+
+void run_coherence(coherence_config *config,
+                   char **trace_names, int trace_count)
+{
+    coherence_sim sim;
+    unsigned long hits = 0, misses = 0, evictions = 0;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.config = config;
+    sim.granule_shift = config->byte_bits_count > 6 ?
+                        config->byte_bits_count - 6 : 0;
+    block_table_init(&sim.table, sizeof(block_entry), INITIAL_TABLE_SIZE);
+    if (config->llc_lines_count > 0) {
+        sim.llc = init_cache(config->llc_set_bits_count,
+                             config->llc_lines_count,
+                             config->llc_byte_bits_count);
+    }
+
+    run_traces(&sim, trace_names, trace_count);
+
+    for (int core = 0; core < config->cores; core++) {
+        core_stats *stats = &sim.stats[core];
+        printf("core %d: hits:%lu misses:%lu evictions:%lu invalidations:%lu "
+               "coherence_misses:%lu false_sharing:%lu writebacks:%lu "
+               "upgrades:%lu\n",
+               core, stats->hits, stats->misses, stats->evictions,
+               stats->invalidations, stats->coherence_misses,
+               stats->false_sharing, stats->writebacks, stats->upgrades);
+        hits += stats->hits;
+        misses += stats->misses;
+        evictions += stats->evictions;
+        if (sim.caches[core] != NULL)
+            delete_cache(sim.caches[core]);
+    }
+    if (sim.llc != NULL) {
+        printf("llc: hits:%lu misses:%lu evictions:%lu\n",
+               sim.llc_hits, sim.llc_misses, sim.llc_evictions);
+        delete_cache(sim.llc);
+    }
+    printf("%s %s: %s:%lu cache_to_cache:%lu memory_reads:%lu",
+           config->protocol == PROTOCOL_MOESI ? "MOESI" : "MESI",
+           config->model == MODEL_DIRECTORY ? "directory" : "snoop",
+           config->model == MODEL_DIRECTORY ? "messages" : "bus_transactions",
+           sim.messages, sim.transfers, sim.memory_reads);
+    if (config->model == MODEL_SNOOP)
+        printf(" snoop_lookups:%lu", sim.snoop_lookups);
+    printf("\n");
+    print_top_blocks(&sim);
+    table_free(&sim.table);
+
+    print_totals(hits, misses, evictions);
+}
@@ -0,0 +1,42 @@
+/*
+ * coherence.h - Multi-core cache coherence simulation for csim
+ */
+
+#ifndef CACHELAB_COHERENCE_H
+#define CACHELAB_COHERENCE_H
+
+#define MAX_CORES 64
+
+typedef enum {
+    PROTOCOL_MESI,
+    PROTOCOL_MOESI
+} coherence_protocol;
+
+typedef enum {
+    MODEL_SNOOP,     // every miss and upgrade is broadcast to all cores
+    MODEL_DIRECTORY  // a sharer vector per block directs the messages
+} coherence_model;
+
+typedef struct {
+    int cores;
+    int set_bits_count;   // geometry of each private cache
+    int lines_count;
+    int byte_bits_count;
+    int llc_set_bits_count; // geometry of the shared LLC,
+    int llc_lines_count;    // llc_lines_count == 0 means no LLC
+    int llc_byte_bits_count;
+    coherence_protocol protocol;
+    coherence_model model;
+} coherence_config;
+
+/*
+ * run_coherence - Simulate config.cores private caches kept coherent by
+ *     the selected protocol. With one trace per core the traces are
+ *     interleaved round robin, with a single trace every access names
+ *     its core in a trailing thread id field (" L 10,4 3"). Prints the
+ *     per-core and per-block results followed by printSummary's totals.
+ */
+void run_coherence(coherence_config *config,
+                   char **trace_names, int trace_count);
+
+#endif /* CACHELAB_COHERENCE_H */
@@ -0,0 +1,126 @@
+/*
+ * csim-top.c - Watch a running csim -m through its live stats segment
+ *
+ * Prints a line per interval with progress through the trace, the
+ * estimated time left, throughput and the overall and recent miss rates.
+ * Exits once the simulation reports it is done or its process is gone.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "livestats.h"
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-h] [-i seconds] [-n samples] <name>\n", name);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -i <secs>   Seconds between samples (default 1)\n");
+    printf("  -n <count>  Stop after count samples (default until csim ends)\n");
+    printf("  <name>      Name given to csim -m, found in /dev/shm\n");
+}
+
+static double miss_rate(uint64_t hits, uint64_t misses)
+{
+    return hits + misses ? 100.0 * misses / (hits + misses) : 0;
+}
+
+static void format_eta(char *buf, size_t len, double seconds)
+{
+    if (seconds < 0) {
+        snprintf(buf, len, "--:--:--");
+        return;
+    }
+    long s = (long) seconds;
+    snprintf(buf, len, "%02ld:%02ld:%02ld", s / 3600, (s / 60) % 60, s % 60);
+}
+
+int main(int argc, char *argv[])
+{
+    double interval = 1;
+    long samples = -1;
+    char c;
+
+    while ((c = getopt(argc, argv, "hi:n:")) != -1) {
+        switch (c) {
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 'n':
+            samples = atol(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (optind != argc - 1 || interval <= 0) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    live_stats *ls = attach_live_stats(argv[optind]);
+    if (ls == NULL)
+        exit(1);
+
+    live_stats now, prev;
+    struct timespec pause;
+    pause.tv_sec = (time_t) interval;
+    pause.tv_nsec = (long) ((interval - pause.tv_sec) * 1e9);
+
+    read_live_stats(ls, &prev);
+    printf("csim pid %ld on %s\n", (long) prev.pid, prev.trace_name);
+    printf("%8s %7s %9s %14s %12s %8s %8s\n", "elapsed", "done", "eta",
+           "accesses", "acc/s", "miss%", "recent%");
+    while (samples != 0) {
+        nanosleep(&pause, NULL);
+        read_live_stats(ls, &now);
+
+        char eta[16], done[16] = "-"; // size unknown when read from a pipe
+        double eta_secs = -1;
+        if (now.trace_size > 0) {
+            snprintf(done, sizeof(done), "%.1f%%",
+                     100.0 * now.trace_offset / now.trace_size);
+            double bytes_per_sec = (now.trace_offset - prev.trace_offset) /
+                                   (now.elapsed - prev.elapsed);
+            if (now.elapsed > prev.elapsed && bytes_per_sec > 0)
+                eta_secs = (now.trace_size - now.trace_offset) / bytes_per_sec;
+        }
+        if (now.done) {
+            snprintf(done, sizeof(done), "100.0%%");
+            eta_secs = 0;
+        }
+        format_eta(eta, sizeof(eta), eta_secs);
+
+        printf("%7.1fs %7s %9s %14llu %12.0f %7.3f%% %7.3f%%\n",
+               now.elapsed, done, eta, (unsigned long long) now.accesses,
+               now.accesses_per_sec, miss_rate(now.hits, now.misses),
+               miss_rate(now.hits - prev.hits, now.misses - prev.misses));
+        fflush(stdout);
+
+        if (now.done) {
+            printf("csim finished: hits:%llu misses:%llu evictions:%llu\n",
+                   (unsigned long long) now.hits,
+                   (unsigned long long) now.misses,
+                   (unsigned long long) now.evictions);
+            break;
+        }
+        if (kill((pid_t) now.pid, 0) != 0 && errno == ESRCH) {
+            printf("csim (pid %ld) exited without finishing\n", (long) now.pid);
+            break;
+        }
+        prev = now;
+        if (samples > 0)
+            samples--;
+    }
+    return 0;
+}
@@ -1,29 +1,354 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include "cachelab.h"
+#include "coherence.h"
+#include "prefetch.h"
+#include "tlb.h"
+#include "classify.h"
+#include "livestats.h"
+#include "tracepar.h"
+#include "amat.h"
 
 #define BUFF_SIZE 1024
 #define MAX_HEX_DIGITS 17 // accomodate the termination character
+#define DEFAULT_PREFETCH_LATENCY 10 // accesses before a prefetch arrives
+#define PTE_SIZE 8
+#define SINGLE_CORE_OPTS "fdlwnkgWcimvTjx" // not modelled by -p
+#define STDOUT_BUFF_SIZE (1 << 20) // verbose output is flushed in big writes
+#define TIMING_BATCH 4096 // records parsed ahead and simulated per -T probe
+#define PROBE_CALIBRATIONS 64
 
-int main(int argc, char **argv)
+/*
+ * read_cycles - Cycle counter for -T, nanoseconds where there is no TSC
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define CYCLE_SOURCE "tsc"
+static inline unsigned long long read_cycles(void)
+{
+    return __rdtsc();
+}
+#else
+#define CYCLE_SOURCE "clock"
+static inline unsigned long long read_cycles(void)
 {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+typedef struct csim_state csim_state;
+typedef void (*access_fn)(csim_state *st, unsigned long pc, long address,
+                          char op, int size);
+
+/* State of a single core run, shared by the per access helpers */
+struct csim_state {
+    access_fn access;        // handler for each record, picked at startup
+    unsigned long long simulate_cycles;
+    unsigned long long probe_cycles; // cost of the -T probes around a batch
+    cache *instance_cache;
+    prefetch_sim *prefetch;  // NULL unless -f was given
+    int model_writes;        // -w: write policy, traffic and access sizes
+    tlb *instance_tlb;       // NULL unless -k was given
+    int walks_to_cache;      // -W: TLB misses load page table entries
+    classifier *classify;    // NULL unless -c was given
+    amat_model *amat;
+    live_stats *live;
+    FILE *f_stream;
+    long batch_end;             // trace offset of the -j batch, else -1
+    unsigned long pc;           // address of the last instruction record
+    unsigned long records;
+    int until_publish;          // records until the next live stats update
+    unsigned long instructions; // 'I' records seen
     int hits, misses, evictions;
+};
+
+/*
+ * access_block - Simulate an access that stays within one block
+ */
+static void access_block(csim_state *st, unsigned long pc, long address,
+                         char op, int size)
+{
+    int hits = st->hits, misses = st->misses;
+    cache *instance_cache = st->instance_cache;
+    unsigned long dirty_evictions = instance_cache->dirty_evictions;
+    unsigned long bytes_written = instance_cache->bytes_written;
+
+    if (st->prefetch != NULL) {
+        prefetch_update_counts(st->prefetch, pc, address, op, size,
+                               &st->hits, &st->misses, &st->evictions);
+    } else if (st->model_writes) {
+        policy_update_counts(st->instance_cache, address, op, size,
+                             &st->hits, &st->misses, &st->evictions);
+    } else {
+        update_counts(st->instance_cache, address, op,
+                      &st->hits, &st->misses, &st->evictions);
+    }
+    if (st->classify != NULL) {
+        classify_access(st->classify, address, st->misses != misses);
+    }
+    if (st->amat != NULL) {
+        int writebacks = 0;
+        // next level writes are only tracked when writes are modelled
+        if (st->model_writes) {
+            unsigned long dirty = instance_cache->dirty_evictions -
+                                  dirty_evictions;
+            unsigned long stored = instance_cache->bytes_written -
+                                   bytes_written -
+                                   (dirty << instance_cache->byte_mask_length);
+            // each dirty block, plus a store written through or around
+            writebacks = dirty + (stored != 0);
+        }
+        amat_access(st->amat, st->hits - hits, st->misses - misses, writebacks);
+    }
+}
+
+/*
+ * translate - Look the page of address up in the TLBs, a miss in every
+ *     level optionally sends the page walk's loads to the data cache
+ */
+static void translate(csim_state *st, unsigned long pc, long address)
+{
+    unsigned long walk[MAX_WALK_LEVELS];
+
+    if (!tlb_translate(st->instance_tlb, address) || !st->walks_to_cache)
+        return;
+    int levels = tlb_walk_addresses(st->instance_tlb, address, walk);
+    int misses = st->misses;
+    for (int i = 0; i < levels; i++)
+        access_block(st, pc, walk[i], 'L', PTE_SIZE);
+    st->instance_tlb->walk_refs += levels;
+    st->instance_tlb->walk_misses += st->misses - misses;
+}
+
+/*
+ * simulate_access - Simulate one trace record. Like the reference
+ *     simulator the size is ignored unless writes are modelled, then an
+ *     access that crosses a block boundary touches every block it covers.
+ */
+static void simulate_access(csim_state *st, unsigned long pc, long address,
+                            char op, int size)
+{
+    if (st->instance_tlb != NULL) {
+        long last = address + (size > 0 ? size : 1) - 1;
+        translate(st, pc, address);
+        if ((last ^ address) >> st->instance_tlb->page_bits)
+            translate(st, pc, last); // the access spills onto the next page
+    }
+    if (!st->model_writes) {
+        access_block(st, pc, address, op, size);
+        return;
+    }
+    long block_size = 1L << st->instance_cache->byte_mask_length;
+    long end = address + (size > 0 ? size : 1);
+    while (address < end) {
+        long next = (address | (block_size - 1)) + 1;
+        long part_end = next < end ? next : end;
+        access_block(st, pc, address, op, part_end - address);
+        address = next;
+    }
+}
+
+static void verbose_token(const char *token, int count)
+{
+    for (int i = 0; i < count; i++)
+        fputs_unlocked(token, stdout);
+}
+
+/*
+ * verbose_access - simulate_access that also logs the record like the
+ *     reference simulator's -v. The line is formatted by hand and lands
+ *     in stdout's STDOUT_BUFF_SIZE buffer, so there is neither a printf
+ *     nor a write per access.
+ */
+static void verbose_access(csim_state *st, unsigned long pc, long address,
+                           char op, int size)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[64];
+    char *p = line + sizeof(line);
+    int hits = st->hits, misses = st->misses, evictions = st->evictions;
+
+    simulate_access(st, pc, address, op, size);
+
+    // "op address,size" built backwards from the end of line
+    unsigned int n = size < 0 ? -(unsigned int) size : (unsigned int) size;
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    if (size < 0)
+        *--p = '-';
+    *--p = ',';
+    unsigned long a = address;
+    do {
+        *--p = hex[a & 0xf];
+        a >>= 4;
+    } while (a);
+    *--p = ' ';
+    *--p = op;
+    fwrite_unlocked(p, 1, line + sizeof(line) - p, stdout);
+    verbose_token(" miss", st->misses - misses);
+    verbose_token(" eviction", st->evictions - evictions);
+    verbose_token(" hit", st->hits - hits);
+    putc_unlocked('\n', stdout);
+}
+
+/*
+ * probe_cost - Cycles of a read_cycles pair with nothing between them,
+ *     the least of a few tries
+ */
+static unsigned long long probe_cost(void)
+{
+    unsigned long long best = ~0ULL;
+
+    for (int i = 0; i < PROBE_CALIBRATIONS; i++) {
+        unsigned long long start = read_cycles();
+        unsigned long long cycles = read_cycles() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+    return best;
+}
+
+/*
+ * charge_simulate - Charge the cycles since start, less the probes' own
+ *     cost, to simulate. All other cycles of the main loop are parsing.
+ */
+static void charge_simulate(csim_state *st, unsigned long long start)
+{
+    unsigned long long cycles = read_cycles() - start;
+
+    if (cycles > st->probe_cycles)
+        st->simulate_cycles += cycles - st->probe_cycles;
+}
+
+/*
+ * print_timing - Split the wall time into phases, converting cycles to
+ *     seconds with the rate measured over the whole run
+ */
+static void print_timing(unsigned long long phase_cycles[4], double seconds)
+{
+    static const char *phase_names[4] = {"open", "parse", "simulate", "teardown"};
+    unsigned long long total = 0;
+
+    for (int i = 0; i < 4; i++)
+        total += phase_cycles[i];
+    if (total == 0)
+        total = 1;
+    printf("timing (%s): total %.6fs", CYCLE_SOURCE, seconds);
+    for (int i = 0; i < 4; i++) {
+        printf(" %s %.6fs (%.1f%%)", phase_names[i],
+               seconds * phase_cycles[i] / total,
+               100.0 * phase_cycles[i] / total);
+    }
+    printf("\n");
+}
+
+/*
+ * publish_progress - Update the live stats segment, if there is one
+ */
+static void publish_progress(csim_state *st, int done)
+{
+    live_counters counters;
+    long offset;
+
+    if (st->live == NULL)
+        return;
+    offset = st->batch_end >= 0 ? st->batch_end : ftell(st->f_stream);
+    counters.accesses = st->records;
+    counters.hits = st->hits;
+    counters.misses = st->misses;
+    counters.evictions = st->evictions;
+    counters.trace_offset = offset > 0 ? offset : 0;
+    publish_live_stats(st->live, &counters, done);
+}
+
+/*
+ * run_record - Handle one trace line, whichever parser decoded it
+ */
+static inline void run_record(csim_state *st, char op, unsigned long address,
+                              int size)
+{
+    if (--st->until_publish == 0) {
+        st->until_publish = LIVE_STATS_INTERVAL;
+        publish_progress(st, 0);
+    }
+    st->records++;
+    if (op == 'I') {
+        // Skipping instruction accesses, the stride
+        // prefetcher still wants to know who is accessing
+        st->pc = address;
+        st->instructions++;
+        return;
+    }
+    st->access(st, st->pc, address, op, size);
+}
+
+static void usage(FILE *out, char *name)
+{
+    fprintf(out, "Usage: %s [-hvT] "
+            "-s [#sets] -E [#lines] -b [#byte bits] "
+            "-t [#trace_file_name]\n"
+            "  -h: print this help, -v: log every access, "
+            "-T: report time spent per phase\n"
+            "  -j [#threads]: parse the trace on this many threads\n"
+            "  -x [hit,miss,writeback[,mlp,window]]: estimate cycles "
+            "with these latencies\n"
+            "Multi-core coherence: -p [#cores] [-P mesi|moesi] [-D] "
+            "[-L s,E,b] -t [#trace per core or one tagged trace]\n"
+            "Prefetching: -f [%s] [-d #degree] [-l #latency]\n"
+            "Write policy and traffic: -w [wb|wt] [-n (no write allocate)]\n"
+            "TLB: -k [l1 entries:ways[,l2 entries:ways]] [-g 4k|2m|1g] "
+            "[-W (page walks load through the cache)]\n"
+            "Miss classification: -c [-i #accesses per interval]\n"
+            "Live statistics for csim-top: -m [#name in /dev/shm]\n",
+            name, prefetcher_names);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long phase_start = read_cycles();
+    unsigned long long phase_cycles[4] = {0, 0, 0, 0};
+    double start_seconds = now_seconds();
+    csim_state st;
     int opt, set_bits_count, lines_count, byte_bits_count;
     char *trace_name;
+    char *trace_names[MAX_CORES];
+    int trace_count = 0;
+    coherence_config coherence;
+    char *prefetcher_name = NULL;
+    int prefetch_degree = 0;
+    int prefetch_latency = DEFAULT_PREFETCH_LATENCY;
+    int write_through = 0, no_write_allocate = 0;
+    char *tlb_spec = NULL;
+    char *page_size = "4k";
+    int classify = 0;
+    unsigned long classify_interval = 0;
+    char *live_name = NULL;
+    int verbose = 0, timing = 0;
+    int parse_threads = 0;
+    char *amat_spec = NULL;
+    int single_core_opt = 0; // last option -p cannot honour
 
-    hits = misses = evictions = 0;
+    memset(&st, 0, sizeof(st));
     set_bits_count = lines_count = byte_bits_count = 0;
+    memset(&coherence, 0, sizeof(coherence));
 
     // get options
-    if (argc < 9) {
-        printf("Usage: %s "
-               "-s [#sets] -E [#lines] -b [#byte bits] "
-               "-t [#trace_file_name]", argv[0]);
-    }
-    while((opt = getopt(argc, argv, "s:E:b:t:")) != -1) {
+    while((opt = getopt(argc, argv, "s:E:b:t:p:P:DL:f:d:l:w:nk:g:Wci:m:hvTj:x:")) != -1) {
+        if (strchr(SINGLE_CORE_OPTS, opt) != NULL) {
+            single_core_opt = opt;
+        }
         switch(opt) {
         case 's':
             set_bits_count = atoi(optarg);
@@ -36,41 +361,281 @@ int main(int argc, char **argv)
             break;
         case 't':
             trace_name = optarg;
+            if (trace_count < MAX_CORES) {
+                trace_names[trace_count] = optarg;
+            }
+            trace_count++;
+            break;
+        case 'p':
+            coherence.cores = atoi(optarg);
+            break;
+        case 'P':
+            if (strcmp(optarg, "moesi") == 0) {
+                coherence.protocol = PROTOCOL_MOESI;
+            } else if (strcmp(optarg, "mesi") == 0) {
+                coherence.protocol = PROTOCOL_MESI;
+            } else {
+                fprintf(stderr, "Unknown protocol (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'D':
+            coherence.model = MODEL_DIRECTORY;
+            break;
+        case 'L':
+            if (sscanf(optarg, "%d,%d,%d", &coherence.llc_set_bits_count,
+                       &coherence.llc_lines_count,
+                       &coherence.llc_byte_bits_count) != 3) {
+                fprintf(stderr, "Could not parse LLC geometry (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            prefetcher_name = optarg;
+            break;
+        case 'd':
+            prefetch_degree = atoi(optarg);
+            break;
+        case 'l':
+            prefetch_latency = atoi(optarg);
+            break;
+        case 'w':
+            if (strcmp(optarg, "wt") == 0) {
+                write_through = 1;
+            } else if (strcmp(optarg, "wb") != 0) {
+                fprintf(stderr, "Unknown write policy (%s)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            st.model_writes = 1;
+            break;
+        case 'n':
+            no_write_allocate = 1;
+            st.model_writes = 1;
+            break;
+        case 'k':
+            tlb_spec = optarg;
+            break;
+        case 'g':
+            page_size = optarg;
+            break;
+        case 'W':
+            st.walks_to_cache = 1;
+            break;
+        case 'c':
+            classify = 1;
+            break;
+        case 'i':
+            classify_interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            live_name = optarg;
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            exit(EXIT_SUCCESS);
+        case 'v':
+            verbose = 1;
+            break;
+        case 'T':
+            timing = 1;
+            break;
+        case 'j':
+            parse_threads = atoi(optarg);
+            if (parse_threads < 0) {
+                fprintf(stderr, "-j needs a thread count of 0 or more\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+            amat_spec = optarg;
             break;
         default:
-            fprintf(stderr, "Usage: %s "
-                    "-s [#sets] -E [#lines] -b [#byte bits] "
-                    "-t [#trace_file_name]", argv[0]);
+            usage(stderr, argv[0]);
             exit(EXIT_FAILURE);
         }
     }
 
+    if (lines_count <= 0 || trace_count == 0) {
+        usage(stderr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (coherence.cores > 0) {
+        if (coherence.cores > MAX_CORES ||
+            (trace_count != 1 && trace_count != coherence.cores)) {
+            fprintf(stderr, "Give one trace per core or one tagged trace "
+                    "for at most %d cores\n", MAX_CORES);
+            exit(EXIT_FAILURE);
+        }
+        if (single_core_opt) {
+            fprintf(stderr, "-%c is not supported with -p\n", single_core_opt);
+            exit(EXIT_FAILURE);
+        }
+        coherence.set_bits_count = set_bits_count;
+        coherence.lines_count = lines_count;
+        coherence.byte_bits_count = byte_bits_count;
+        run_coherence(&coherence, trace_names, trace_count);
+        return 0;
+    }
+
     // initialize cache
     cache *instance_cache = init_cache(set_bits_count,
                                        lines_count, byte_bits_count);
+    instance_cache -> write_through = write_through;
+    instance_cache -> no_write_allocate = no_write_allocate;
+    st.instance_cache = instance_cache;
+    if (prefetcher_name != NULL) {
+        prefetcher *pf = create_prefetcher(prefetcher_name, prefetch_degree);
+        if (pf == NULL) {
+            fprintf(stderr, "Unknown prefetcher (%s), choose from %s\n",
+                    prefetcher_name, prefetcher_names);
+            exit(EXIT_FAILURE);
+        }
+        st.prefetch = init_prefetch_sim(instance_cache, pf, prefetch_latency);
+    }
+    if (tlb_spec != NULL) {
+        tlb_config config;
+        if (!parse_tlb_config(&config, tlb_spec, page_size)) {
+            fprintf(stderr, "Could not parse TLB (%s) with %s pages, sets "
+                    "must be a power of two\n", tlb_spec, page_size);
+            exit(EXIT_FAILURE);
+        }
+        st.instance_tlb = init_tlb(&config);
+    }
+    if (classify) {
+        st.classify = init_classifier(instance_cache, classify_interval);
+    }
+    if (amat_spec != NULL) {
+        amat_config config;
+        if (!parse_amat_config(&config, amat_spec)) {
+            fprintf(stderr, "Could not parse latencies (%s), expected "
+                    "hit,miss,writeback[,mlp,window]\n", amat_spec);
+            exit(EXIT_FAILURE);
+        }
+        st.amat = init_amat(&config);
+    }
+    // pick the per record handler once, the loop never tests the flags
+    st.access = verbose ? verbose_access : simulate_access;
+    if (verbose) {
+        setvbuf(stdout, NULL, _IOFBF, STDOUT_BUFF_SIZE);
+    }
+    if (timing) {
+        st.probe_cycles = probe_cost();
+    }
     // open file, start reading and updating counts per line
     FILE *f_stream = fopen(trace_name, "r");
     if (f_stream == NULL) {
-        fprintf(stderr, "Could not open file (%s): %s", trace_name, strerror(errno));
+        fprintf(stderr, "Could not open file (%s): %s\n", trace_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (live_name != NULL) {
+        struct stat trace_stat;
+        uint64_t trace_size = 0;
+        if (fstat(fileno(f_stream), &trace_stat) == 0 &&
+            S_ISREG(trace_stat.st_mode)) {
+            trace_size = trace_stat.st_size;
+        }
+        st.live = create_live_stats(live_name, trace_name, trace_size);
     }
 
     char *buffer = malloc(BUFF_SIZE);
-    int req_size; // size of request
-    unsigned long address;
-    char req_type; // Kind of request (S, M, L)
-    while (fgets(buffer, BUFF_SIZE, f_stream) != NULL) {
-        sscanf(buffer, " %c %lx,%d", &req_type, &address, &req_size);
-        if (req_type == 'I') {
-            // Skipping instruction accesses
-            continue;
+    int req_size = 0; // size of request
+    unsigned long address = 0;
+    char req_type = 0; // Kind of request (S, M, L)
+    unsigned long long loop_start = read_cycles();
+    phase_cycles[0] = loop_start - phase_start;
+    st.f_stream = f_stream;
+    st.batch_end = -1;
+    st.until_publish = LIVE_STATS_INTERVAL;
+    if (parse_threads > 0) {
+        trace_reader *reader = open_trace_reader(f_stream, parse_threads,
+                                                 BUFF_SIZE);
+        trace_batch *batch;
+        while ((batch = next_trace_batch(reader)) != NULL) {
+            unsigned long long start = timing ? read_cycles() : 0;
+            st.batch_end = batch->end_offset;
+            for (int i = 0; i < batch->count; i++) {
+                trace_record *record = &batch->records[i];
+                // fields sscanf did not assign keep their last value
+                if (record->fields > 0)
+                    req_type = record->op;
+                if (record->fields > 1)
+                    address = record->address;
+                if (record->fields > 2)
+                    req_size = record->size;
+                run_record(&st, req_type, address, req_size);
+            }
+            if (timing)
+                charge_simulate(&st, start);
+        }
+        close_trace_reader(reader);
+    } else if (timing) {
+        // probing every record would cost more than simulating it, so a
+        // batch is parsed ahead and then simulated between two probes
+        trace_record *records = alloc_or_die(TIMING_BATCH, sizeof(trace_record),
+                                             "timing batch");
+        int count;
+        do {
+            for (count = 0; count < TIMING_BATCH &&
+                 fgets(buffer, BUFF_SIZE, f_stream) != NULL; count++) {
+                sscanf(buffer, " %c %lx,%d", &req_type, &address, &req_size);
+                records[count].op = req_type;
+                records[count].address = address;
+                records[count].size = req_size;
+            }
+            st.batch_end = ftell(f_stream);
+            unsigned long long start = read_cycles();
+            for (int i = 0; i < count; i++)
+                run_record(&st, records[i].op, records[i].address,
+                           records[i].size);
+            charge_simulate(&st, start);
+        } while (count == TIMING_BATCH);
+        free(records);
+    } else {
+        while (fgets(buffer, BUFF_SIZE, f_stream) != NULL) {
+            sscanf(buffer, " %c %lx,%d", &req_type, &address, &req_size);
+            run_record(&st, req_type, address, req_size);
         }
-        update_counts(instance_cache, address, req_type,
-                      &hits, &misses, &evictions);
     }
+    phase_start = read_cycles();
+    phase_cycles[1] = phase_start - loop_start - st.simulate_cycles;
+    phase_cycles[2] = st.simulate_cycles;
+    publish_progress(&st, 1);
+    close_live_stats(st.live, live_name);
     fclose(f_stream);
     free(buffer);
-    delete_cache(instance_cache);
 
-    printSummary(hits, misses, evictions);
+    printSummary(st.hits, st.misses, st.evictions);
+    if (st.classify != NULL) {
+        print_classify_summary(st.classify);
+        delete_classifier(st.classify);
+    }
+    if (st.instance_tlb != NULL) {
+        print_tlb_summary(st.instance_tlb, st.walks_to_cache);
+        delete_tlb(st.instance_tlb);
+    }
+    if (st.prefetch != NULL) {
+        print_prefetch_summary(st.prefetch);
+        delete_prefetch_sim(st.prefetch);
+    }
+    if (st.model_writes) {
+        printf("traffic %s-%s: dirty_evictions:%lu bytes_read:%lu "
+               "bytes_written:%lu\n",
+               write_through ? "wt" : "wb",
+               no_write_allocate ? "nwa" : "wa",
+               instance_cache -> dirty_evictions,
+               instance_cache -> bytes_read,
+               instance_cache -> bytes_written);
+    }
+    if (st.amat != NULL) {
+        print_amat_summary(st.amat, st.instructions);
+        delete_amat(st.amat);
+    }
+    delete_cache(instance_cache);
+    if (timing) {
+        phase_cycles[3] = read_cycles() - phase_start;
+        print_timing(phase_cycles, now_seconds() - start_seconds);
+    }
     return 0;
 }
@@ -0,0 +1,152 @@
+/*
+ * livestats.c - Publish and read csim's counters through /dev/shm
+ *
+ * csim only writes the segment once every LIVE_STATS_INTERVAL records,
+ * with plain stores ordered by the sequence lock. The per access path
+ * never takes a lock or makes a system call for monitoring, the few
+ * calls to read the clock and trace offset happen once per interval.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cachelab.h"
+#include "livestats.h"
+
+#define SHM_DIR "/dev/shm/"
+
+static double start_time, last_time;
+static uint64_t last_accesses;
+
+static int shm_path(const char *name, char *path, size_t len)
+{
+    if (strchr(name, '/') != NULL || strlen(name) + sizeof(SHM_DIR) > len) {
+        fprintf(stderr, "Bad live stats name (%s)\n", name);
+        return 0;
+    }
+    snprintf(path, len, SHM_DIR "%s", name);
+    return 1;
+}
+
+live_stats *create_live_stats(const char *name, const char *trace_name,
+                              uint64_t trace_size)
+{
+    char path[LIVE_STATS_NAME_LEN];
+    live_stats *ls;
+    int fd;
+
+    if (!shm_path(name, path, sizeof(path)))
+        return NULL;
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(live_stats)) != 0) {
+        fprintf(stderr, "Could not create live stats (%s): %s\n",
+                path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    ls = mmap(NULL, sizeof(live_stats), PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0);
+    close(fd);
+    if (ls == MAP_FAILED) {
+        fprintf(stderr, "Could not map live stats (%s): %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+    ls->pid = getpid();
+    ls->trace_size = trace_size;
+    snprintf(ls->trace_name, sizeof(ls->trace_name), "%s", trace_name);
+    start_time = last_time = now_seconds();
+    last_accesses = 0;
+    // readers only trust the segment once the magic is in place
+    __atomic_store_n(&ls->magic, LIVE_STATS_MAGIC, __ATOMIC_RELEASE);
+    return ls;
+}
+
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+void publish_live_stats(live_stats *ls, live_counters *counters, int done)
+{
+    if (ls == NULL)
+        return;
+
+    double now = now_seconds();
+    double rate = now > last_time ?
+                  (counters->accesses - last_accesses) / (now - last_time) : 0;
+    uint64_t seq = ls->seq;
+
+    STORE(ls->seq, seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    STORE(ls->accesses, counters->accesses);
+    STORE(ls->hits, counters->hits);
+    STORE(ls->misses, counters->misses);
+    STORE(ls->evictions, counters->evictions);
+    STORE(ls->trace_offset, counters->trace_offset);
+    STORE(ls->done, (uint64_t) done);
+    double elapsed = now - start_time;
+    __atomic_store(&ls->accesses_per_sec, &rate, __ATOMIC_RELAXED);
+    __atomic_store(&ls->elapsed, &elapsed, __ATOMIC_RELAXED);
+    __atomic_store_n(&ls->seq, seq + 2, __ATOMIC_RELEASE);
+
+    last_time = now;
+    last_accesses = counters->accesses;
+}
+
+void close_live_stats(live_stats *ls, const char *name)
+{
+    char path[LIVE_STATS_NAME_LEN];
+
+    if (ls == NULL)
+        return;
+    munmap(ls, sizeof(live_stats));
+    // attached readers keep their mapping and see done
+    if (shm_path(name, path, sizeof(path)))
+        unlink(path);
+}
+
+live_stats *attach_live_stats(const char *name)
+{
+    char path[LIVE_STATS_NAME_LEN];
+    live_stats *ls;
+    int fd;
+
+    if (!shm_path(name, path, sizeof(path)))
+        return NULL;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open live stats (%s): %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+    ls = mmap(NULL, sizeof(live_stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ls == MAP_FAILED) {
+        fprintf(stderr, "Could not map live stats (%s): %s\n",
+                path, strerror(errno));
+        return NULL;
+    }
+    if (__atomic_load_n(&ls->magic, __ATOMIC_ACQUIRE) != LIVE_STATS_MAGIC) {
+        fprintf(stderr, "%s is not a csim live stats segment\n", path);
+        munmap(ls, sizeof(live_stats));
+        return NULL;
+    }
+    return ls;
+}
+
+void read_live_stats(live_stats *ls, live_stats *snapshot)
+{
+    uint64_t before, after;
+
+    do {
+        before = __atomic_load_n(&ls->seq, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue; // an update is in progress
+        memcpy(snapshot, ls, sizeof(live_stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&ls->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
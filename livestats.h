@@ -0,0 +1,53 @@
+/*
+ * livestats.h - Counters a running csim publishes in shared memory
+ */
+
+#ifndef CACHELAB_LIVESTATS_H
+#define CACHELAB_LIVESTATS_H
+
+#include <stdint.h>
+
+#define LIVE_STATS_MAGIC 0x6373696d6c697665UL /* "csimlive" */
+#define LIVE_STATS_INTERVAL (1 << 16) /* trace records between updates */
+#define LIVE_STATS_NAME_LEN 256
+
+/*
+ * The segment is written by a single csim under a sequence lock: seq is
+ * odd while an update is in progress, readers retry until they see the
+ * same even value before and after copying the counters.
+ */
+typedef struct {
+    uint64_t magic;
+    int64_t pid;
+    uint64_t seq;
+    uint64_t accesses;          // trace records processed
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t trace_offset;      // bytes of the trace consumed
+    uint64_t trace_size;        // 0 if unknown, e.g. reading a pipe
+    uint64_t done;
+    double accesses_per_sec;    // over the last update interval
+    double elapsed;             // seconds since the simulation started
+    char trace_name[LIVE_STATS_NAME_LEN];
+} live_stats;
+
+typedef struct {
+    uint64_t accesses;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t trace_offset;
+} live_counters;
+
+/* Writer side, used by csim -m */
+live_stats *create_live_stats(const char *name, const char *trace_name,
+                              uint64_t trace_size);
+void publish_live_stats(live_stats *ls, live_counters *counters, int done);
+void close_live_stats(live_stats *ls, const char *name);
+
+/* Reader side, used by csim-top */
+live_stats *attach_live_stats(const char *name);
+void read_live_stats(live_stats *ls, live_stats *snapshot);
+
+#endif /* CACHELAB_LIVESTATS_H */
@@ -0,0 +1,311 @@
+/*
+ * prefetch.c - Next-line, stride and stream buffer prefetchers
+ *
+ * Prefetched blocks are filled into the cache with LINE_PREFETCHED set.
+ * The first demand hit on such a line clears the bit and counts the
+ * prefetch as useful, and as late if the prefetch was issued fewer than
+ * latency demand accesses earlier. Victims of prefetch fills go into a
+ * small direct mapped filter, so that a demand miss on one of them can
+ * be blamed on the prefetch that pushed it out.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cachelab.h"
+#include "prefetch.h"
+
+#define STRIDE_ENTRIES 256
+#define STREAM_BUFFERS 4
+#define PREFETCH_HIT 2  // observe's hit for the first use of a prefetched line
+
+const char *prefetcher_names = "nextline, stride, stream";
+
+static unsigned long block_bytes(prefetch_sim *sim)
+{
+    return 1UL << sim->instance_cache->byte_mask_length;
+}
+
+static unsigned long block_of(prefetch_sim *sim, unsigned long address)
+{
+    return address >> sim->instance_cache->byte_mask_length;
+}
+
+/*
+ * Next-line - tagged prefetch of the following degree blocks on a miss
+ *     or on the first use of a prefetched block
+ */
+static void nextline_observe(prefetcher *self, prefetch_sim *sim,
+                             unsigned long pc, unsigned long address, int hit)
+{
+    if (hit == 1)
+        return;
+    for (int i = 1; i <= self->degree; i++)
+        issue_prefetch(sim, address + i * block_bytes(sim));
+}
+
+/*
+ * Stride - a table indexed by the pc of the accessing instruction that
+ *     prefetches ahead once the same stride was seen twice in a row
+ */
+typedef struct {
+    unsigned long pc;
+    unsigned long last_address;
+    long stride;
+    int confidence;
+} stride_entry;
+
+static void stride_observe(prefetcher *self, prefetch_sim *sim,
+                           unsigned long pc, unsigned long address, int hit)
+{
+    stride_entry *table = self->state;
+    stride_entry *entry = &table[(pc ^ (pc >> 8)) % STRIDE_ENTRIES];
+
+    if (entry->pc != pc) {
+        entry->pc = pc;
+        entry->last_address = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+    long stride = (long) (address - entry->last_address);
+    if (stride != 0 && stride == entry->stride) {
+        if (entry->confidence < 3)
+            entry->confidence++;
+    } else {
+        entry->stride = stride;
+        entry->confidence = 0;
+    }
+    entry->last_address = address;
+    if (entry->confidence >= 2) {
+        for (int i = 1; i <= self->degree; i++)
+            issue_prefetch(sim, address + i * stride);
+    }
+}
+
+/*
+ * Stream buffer - FIFOs of sequential blocks kept outside the cache. A
+ *     demand miss that matches the head of a buffer moves the block into
+ *     the cache and fetches one more at the tail, any other miss
+ *     restarts the least recently used buffer after the missing block.
+ */
+typedef struct {
+    unsigned long head_block;
+    int head;                 // index of head_block's slot in ready
+    int count;
+    unsigned long last_used;
+    unsigned long *ready;
+} stream_buffer;
+
+static int stream_probe(prefetcher *self, prefetch_sim *sim,
+                        unsigned long address, unsigned long *ready)
+{
+    stream_buffer *buffers = self->state;
+    unsigned long block = block_of(sim, address);
+    int depth = self->degree;
+    stream_buffer *lru = &buffers[0];
+
+    for (int i = 0; i < STREAM_BUFFERS; i++) {
+        stream_buffer *sb = &buffers[i];
+        if (sb->count > 0 && sb->head_block == block) {
+            *ready = sb->ready[sb->head];
+            // the slot just freed takes the block after the tail
+            sb->ready[sb->head] = sim->clock + sim->latency;
+            sb->head = (sb->head + 1) % depth;
+            sb->head_block++;
+            sb->last_used = sim->clock;
+            sim->stats.issued++;
+            return 1;
+        }
+        if (sb->last_used < lru->last_used)
+            lru = sb;
+    }
+    sim->stats.unused += lru->count;
+    lru->head_block = block + 1;
+    lru->head = 0;
+    lru->count = depth;
+    lru->last_used = sim->clock;
+    for (int i = 0; i < depth; i++)
+        lru->ready[i] = sim->clock + sim->latency;
+    sim->stats.issued += depth;
+    return 0;
+}
+
+static void stream_observe(prefetcher *self, prefetch_sim *sim,
+                           unsigned long pc, unsigned long address, int hit)
+{
+}
+
+static void stream_destroy(prefetcher *self)
+{
+    stream_buffer *buffers = self->state;
+    for (int i = 0; i < STREAM_BUFFERS; i++)
+        free(buffers[i].ready);
+}
+
+prefetcher *create_prefetcher(const char *name, int degree)
+{
+    prefetcher *pf = alloc_or_die(1, sizeof(prefetcher), "prefetcher");
+
+    pf->name = name;
+    pf->degree = degree > 0 ? degree : 1;
+    if (strcmp(name, "nextline") == 0) {
+        pf->observe = nextline_observe;
+    } else if (strcmp(name, "stride") == 0) {
+        pf->observe = stride_observe;
+        pf->state = alloc_or_die(STRIDE_ENTRIES, sizeof(stride_entry),
+                                 "prefetcher");
+    } else if (strcmp(name, "stream") == 0) {
+        stream_buffer *buffers = alloc_or_die(STREAM_BUFFERS,
+                                              sizeof(stream_buffer),
+                                              "prefetcher");
+        pf->degree = degree > 0 ? degree : 4; // depth of each buffer
+        for (int i = 0; i < STREAM_BUFFERS; i++)
+            buffers[i].ready = alloc_or_die(pf->degree, sizeof(unsigned long),
+                                            "prefetcher");
+        pf->observe = stream_observe;
+        pf->probe = stream_probe;
+        pf->destroy = stream_destroy;
+        pf->state = buffers;
+    } else {
+        free(pf);
+        return NULL;
+    }
+    return pf;
+}
+
+prefetch_sim *init_prefetch_sim(cache *instance_cache, prefetcher *pf,
+                                int latency)
+{
+    prefetch_sim *sim = alloc_or_die(1, sizeof(prefetch_sim), "prefetcher");
+    sim->instance_cache = instance_cache;
+    sim->pf = pf;
+    sim->latency = latency;
+    return sim;
+}
+
+static unsigned long inflight_ready(prefetch_sim *sim, unsigned long block)
+{
+    unsigned long ready = 0;
+    for (int i = 0; i < INFLIGHT_SLOTS; i++) {
+        if (sim->inflight_block[i] == block && sim->inflight_ready[i] > ready)
+            ready = sim->inflight_ready[i];
+    }
+    return ready;
+}
+
+static void fill(prefetch_sim *sim, unsigned long address, int prefetched)
+{
+    cache *c = sim->instance_cache;
+    unsigned long block = block_of(sim, address);
+    long victim;
+    unsigned char victim_flags;
+    int line;
+
+    if (cache_fill(c, address, &line, &victim, &victim_flags)) {
+        *sim->evictions += 1;
+        if (victim_flags & LINE_PREFETCHED)
+            sim->stats.unused++;
+        if (prefetched) {
+            unsigned long victim_block = block_of(sim, victim);
+            sim->pollution[victim_block % POLLUTION_SLOTS] = victim_block + 1;
+        }
+    }
+    if (sim->pollution[block % POLLUTION_SLOTS] == block + 1)
+        sim->pollution[block % POLLUTION_SLOTS] = 0;
+    if (prefetched)
+        *(cache_set_of(c, address)->flags + line) |= LINE_PREFETCHED;
+}
+
+void issue_prefetch(prefetch_sim *sim, unsigned long address)
+{
+    if (cache_lookup(sim->instance_cache, address) >= 0)
+        return;
+    fill(sim, address, 1);
+    sim->stats.issued++;
+    sim->inflight_block[sim->inflight_next] = block_of(sim, address);
+    sim->inflight_ready[sim->inflight_next] = sim->clock + sim->latency;
+    sim->inflight_next = (sim->inflight_next + 1) % INFLIGHT_SLOTS;
+}
+
+/*
+ * demand - One demand access, returns observe's hit value
+ */
+static int demand(prefetch_sim *sim, long address, int *hits, int *misses)
+{
+    cache *c = sim->instance_cache;
+    unsigned long block = block_of(sim, address);
+    int line = cache_lookup(c, address);
+    unsigned long ready;
+
+    sim->clock++;
+    if (line >= 0) {
+        unsigned char *flags = cache_set_of(c, address)->flags + line;
+        *hits = *hits + 1;
+        cache_touch(c, address, line);
+        if (!(*flags & LINE_PREFETCHED))
+            return 1;
+        *flags &= ~LINE_PREFETCHED;
+        sim->stats.useful++;
+        if (inflight_ready(sim, block) > sim->clock)
+            sim->stats.late++;
+        return PREFETCH_HIT;
+    }
+    if (sim->pf->probe != NULL && sim->pf->probe(sim->pf, sim, address, &ready)) {
+        // served by the prefetcher's own storage
+        *hits = *hits + 1;
+        sim->stats.useful++;
+        if (ready > sim->clock)
+            sim->stats.late++;
+        fill(sim, address, 0);
+        return PREFETCH_HIT;
+    }
+    *misses = *misses + 1;
+    if (sim->pollution[block % POLLUTION_SLOTS] == block + 1)
+        sim->stats.polluting++;
+    fill(sim, address, 0);
+    return 0;
+}
+
+void prefetch_update_counts(prefetch_sim *sim, unsigned long pc, long address,
+                            char op, int size, int *hits, int *misses,
+                            int *evictions)
+{
+    cache *c = sim->instance_cache;
+    int hit;
+
+    sim->evictions = evictions;
+    if (op == 'S' && c->no_write_allocate && cache_lookup(c, address) < 0) {
+        // the store goes around the cache
+        sim->clock++;
+        *misses = *misses + 1;
+        c->bytes_written += size;
+        hit = 0;
+    } else {
+        hit = demand(sim, address, hits, misses);
+        if (op == 'M') {
+            // the store always hits the line the load just brought in
+            *hits = *hits + 1;
+        }
+        if (op != 'L')
+            cache_store(c, address, cache_lookup(c, address), size);
+    }
+    sim->pf->observe(sim->pf, sim, pc, address, hit);
+}
+
+void print_prefetch_summary(prefetch_sim *sim)
+{
+    prefetch_stats *stats = &sim->stats;
+    printf("prefetch %s: issued:%lu useful:%lu late:%lu polluting:%lu "
+           "unused:%lu\n", sim->pf->name, stats->issued, stats->useful,
+           stats->late, stats->polluting, stats->unused);
+}
+
+void delete_prefetch_sim(prefetch_sim *sim)
+{
+    prefetcher *pf = sim->pf;
+    if (pf->destroy != NULL)
+        pf->destroy(pf);
+    free(pf->state);
+    free(pf);
+    free(sim);
+}
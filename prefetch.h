@@ -0,0 +1,72 @@
+/*
+ * prefetch.h - Hardware prefetcher models for csim
+ */
+
+#ifndef CACHELAB_PREFETCH_H
+#define CACHELAB_PREFETCH_H
+
+#include "cachelab.h"
+
+#define INFLIGHT_SLOTS 64     // recent prefetches checked for lateness
+#define POLLUTION_SLOTS 4096  // blocks recently evicted by a prefetch
+
+typedef struct prefetch_sim prefetch_sim;
+typedef struct prefetcher prefetcher;
+
+/*
+ * A prefetcher sees every demand access after the cache was updated and
+ * may call issue_prefetch. Prefetchers with storage of their own (the
+ * stream buffer) also get to satisfy demand misses through probe, which
+ * sets *ready to the clock at which the matching block arrives.
+ */
+struct prefetcher {
+    const char *name;
+    void (*observe)(prefetcher *self, prefetch_sim *sim, unsigned long pc,
+                    unsigned long address, int hit);
+    int (*probe)(prefetcher *self, prefetch_sim *sim, unsigned long address,
+                 unsigned long *ready);
+    void (*destroy)(prefetcher *self);
+    int degree;
+    void *state;
+};
+
+typedef struct {
+    unsigned long issued;     // prefetches that brought a block in
+    unsigned long useful;     // prefetched blocks later hit by a demand access
+    unsigned long late;       // useful ones the demand caught still in flight
+    unsigned long polluting;  // demand misses on blocks a prefetch evicted
+    unsigned long unused;     // prefetched blocks dropped before any use
+} prefetch_stats;
+
+struct prefetch_sim {
+    cache *instance_cache;
+    prefetcher *pf;
+    int latency;              // demand accesses before a prefetch arrives
+    unsigned long clock;      // demand accesses so far
+    int *evictions;           // csim's eviction counter, prefetch fills count
+    prefetch_stats stats;
+    unsigned long inflight_block[INFLIGHT_SLOTS];
+    unsigned long inflight_ready[INFLIGHT_SLOTS];
+    int inflight_next;
+    unsigned long pollution[POLLUTION_SLOTS]; // block number + 1, 0 is empty
+};
+
+/* Returns NULL for an unknown name, see prefetcher_names */
+prefetcher *create_prefetcher(const char *name, int degree);
+extern const char *prefetcher_names;
+
+prefetch_sim *init_prefetch_sim(cache *instance_cache, prefetcher *pf,
+                                int latency);
+/*
+ * prefetch_update_counts - update_counts for a cache with a prefetcher,
+ *     pc is the address of the last 'I' record seen before the access
+ */
+void prefetch_update_counts(prefetch_sim *sim, unsigned long pc, long address,
+                            char op, int size, int *hits, int *misses,
+                            int *evictions);
+/* Install a block on behalf of a prefetcher, unless it is already cached */
+void issue_prefetch(prefetch_sim *sim, unsigned long address);
+void print_prefetch_summary(prefetch_sim *sim);
+void delete_prefetch_sim(prefetch_sim *sim);
+
+#endif /* CACHELAB_PREFETCH_H */
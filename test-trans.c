@@ -3,6 +3,7 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,10 +13,12 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
+#include "bench.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
-/* Maximum array dimension */
+/* Largest graded dimension. Bigger runs are not timed out and their
+   traces are streamed to the simulator without being saved. */
 #define MAXN 256
 
 /* The description string for the transpose_submit() function that the
@@ -33,6 +36,16 @@ extern int func_counter;
 static int M = 0;
 static int N = 0;
 
+/* Square sizes benchmarked after MxN when -S is not given */
+static const int default_bench_sizes[] = {256, 1024, 2048};
+
+/* Placement options passed on to tracegen */
+static char tracegen_opts[128] = "";
+
+/* Wall-clock benchmark settings, enabled with -B */
+static int run_bench = 0;
+static bench_opts_t bench_opts;
+
 /* The correctness and performance for the submitted transpose function */
 struct results {
     int funcid;
@@ -41,22 +54,44 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/*
+ * in_trace_region - Accesses kept in a function's trace. Valgrind creates
+ *     many spurious accesses to the stack that have nothing to do with the
+ *     students code. At the moment, we are ignoring all stack accesses by
+ *     recording accesses to only the low 32-bit portion of the address
+ *     space, where the program's globals are, and to the matrices, which
+ *     tracegen maps wherever the kernel puts them. At some point it would
+ *     be nice to try to do more informed filtering so that would eliminate
+ *     the valgrind stack references while include the student stack
+ *     references.
+ */
+static int in_trace_region(unsigned long long addr,
+                           unsigned long long matrices[4])
+{
+    return addr < 0xffffffff ||
+           (addr >= matrices[0] && addr < matrices[1]) ||
+           (addr >= matrices[2] && addr < matrices[3]);
+}
+
 /* 
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
 void eval_perf(unsigned int s, unsigned int E, unsigned int b)
 {
-    int i,flag;
+    int i,flag,status;
     unsigned int len, hits, misses, evictions;
     unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
+    unsigned long long int matrices[4];
+    char buf[1000], cmd[512];
     char filename[128];
+    char *markers;
 
     registerFunctions(); 
 
-    /* Open the complete trace file */
+    /* The trace is filtered as valgrind produces it */
     FILE* full_trace_fp;  
     FILE* part_trace_fp; 
+    FILE* sim_fp;
 
     /* Evaluate the performance of each registered transpose function */
 
@@ -68,78 +103,76 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
         printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
         /* Use valgrind to generate the trace */
 
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
-        if (0!=flag) {
-            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
-            continue;
-        }
-
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
-
-
-        func_list[i].correct=1;
-
-        /* Save the correctness of the transpose submission */
-        if (results.funcid == i ) {
-            results.correct = 1;
-        }
-
-        full_trace_fp = fopen("trace.tmp", "r");
+        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d%s", M, N, i, tracegen_opts);
+        full_trace_fp = popen(cmd, "r");
         assert(full_trace_fp);
 
-
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
+        /* The bounded region goes straight into the reference simulator,
+           and is only kept as trace.f<i> at sizes that are graded */
+        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
+        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t /dev/stdin > /dev/null",
+                s, E, b);
+        sim_fp = popen(cmd, "w");
+        assert(sim_fp);
+        part_trace_fp = NULL;
+        if (M <= MAXN && N <= MAXN) {
+            /* Filtered trace for each transpose function goes in a separate file */
+            sprintf(filename, "trace.f%d", i);
+            part_trace_fp = fopen(filename, "w");
+            assert(part_trace_fp);
+        }
     
-        /* Locate trace corresponding to the trans function */
+        /* Locate trace corresponding to the trans function, reading to
+           the end so that valgrind is never blocked on a full pipe */
         flag = 0;
+        marker_start = marker_end = 0;
+        memset(matrices, 0, sizeof(matrices));
         while (fgets(buf, 1000, full_trace_fp) != NULL) {
 
+            /* tracegen prints the markers before the region starts */
+            if ((markers = strstr(buf, "MARKERS ")) != NULL) {
+                sscanf(markers, "MARKERS %llx %llx %llx %llx %llx %llx",
+                       &marker_start, &marker_end, &matrices[0],
+                       &matrices[1], &matrices[2], &matrices[3]);
+                continue;
+            }
+
             /* We are only interested in memory access instructions */
             if (buf[0]==' ' && buf[2]==' ' &&
                 (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
                 sscanf(buf+3, "%llx,%u", &addr, &len);
         
                 /* If start marker found, set flag */
-                if (addr == marker_start)
+                if (marker_start != 0 && addr == marker_start)
                     flag = 1;
 
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
+                if (flag && in_trace_region(addr, matrices)) {
+                    fputs(buf, sim_fp);
+                    if (part_trace_fp != NULL)
+                        fputs(buf, part_trace_fp);
                 }
 
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
+                /* if end marker found, stop recording */
+                if (flag && addr == marker_end)
                     flag = 0;
-                    fclose(part_trace_fp);
-                    break;
-                }
             }
         }
-        fclose(full_trace_fp);
+        if (part_trace_fp != NULL)
+            fclose(part_trace_fp);
+        pclose(sim_fp);
+        status = pclose(full_trace_fp);
+        flag = WEXITSTATUS(status);
+        if (0!=flag) {
+            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d%s for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i,tracegen_opts);      
+            continue;
+        }
 
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
+        func_list[i].correct=1;
+
+        /* Save the correctness of the transpose submission */
+        if (results.funcid == i ) {
+            results.correct = 1;
+        }
     
         /* Collect results from the reference simulator */
         FILE* in_fp = fopen(".csim_results","r");
@@ -167,8 +200,15 @@ void usage(char *argv[]){
     printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
-    printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
-    printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
+    printf("  -M <rows>   Number of matrix rows (graded up to %d)\n", MAXN);
+    printf("  -N <cols>   Number of  matrix columns (graded up to %d)\n", MAXN);
+    printf("  -a <bytes>  Alignment of A and B, a power of two (default 4096)\n");
+    printf("  -o <bytes>  Extra offset of B from A's aligned end (default 0)\n");
+    printf("  -H          Put A and B on huge pages, -a and -o still place B\n");
+    printf("  -B          Also benchmark the functions on real memory.\n");
+    printf("  -S <sizes>  Benchmark sizes as MxN[,MxN...] (default MxN,256x256,1024x1024,2048x2048)\n");
+    printf("  -r <runs>   Timed runs per benchmark configuration (default 5)\n");
+    printf("  -c <cpu>    CPU to pin the benchmark to, -1 for none (default 0)\n");
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
 }
 
@@ -198,8 +238,10 @@ void sigalrm_handler(int signum){
 int main(int argc, char* argv[])
 {
     char c;
+    char *bench_sizes = NULL;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    initBenchOpts(&bench_opts);
+    while ((c = getopt(argc,argv,"M:N:hBS:r:c:a:o:H")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +249,39 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'B':
+            run_bench = 1;
+            break;
+        case 'S':
+            bench_sizes = optarg;
+            break;
+        case 'r':
+            bench_opts.reps = atoi(optarg);
+            break;
+        case 'c':
+            bench_opts.cpu = atoi(optarg);
+            break;
+        case 'a':
+        case 'o': {
+            /* checked here, tracegen failing would read as a wrong result */
+            char *end;
+            unsigned long bytes = strtoul(optarg, &end, 0);
+            if (*optarg == '\0' || *end != '\0' ||
+                (c == 'a' && (bytes == 0 || (bytes & (bytes - 1)) != 0))) {
+                printf("Error: -%c needs %s\n", c,
+                       c == 'a' ? "a power of two" : "a byte count");
+                usage(argv);
+                exit(1);
+            }
+            snprintf(tracegen_opts + strlen(tracegen_opts),
+                     sizeof(tracegen_opts) - strlen(tracegen_opts),
+                     " -%c %lu", c, bytes);
+            break;
+        }
+        case 'H':
+            strncat(tracegen_opts, " -H",
+                    sizeof(tracegen_opts) - strlen(tracegen_opts) - 1);
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -222,10 +297,31 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    if (M > MAXN || N > MAXN) {
-        printf("Error: M or N exceeds %d\n", MAXN);
-        usage(argv);
-        exit(1);
+    if (run_bench) {
+        if (bench_opts.reps <= 0) {
+            printf("Error: -r must be positive\n");
+            usage(argv);
+            exit(1);
+        }
+        if (bench_sizes != NULL) {
+            if (!parseBenchSizes(&bench_opts, bench_sizes)) {
+                printf("Error: could not parse benchmark sizes \"%s\"\n", bench_sizes);
+                usage(argv);
+                exit(1);
+            }
+        } else {
+            bench_opts.sizes[0][0] = M;
+            bench_opts.sizes[0][1] = N;
+            bench_opts.num_sizes = 1;
+            for (int k = 0; k < sizeof(default_bench_sizes) / sizeof(int); k++) {
+                int n = default_bench_sizes[k];
+                if (n == M && n == N)
+                    continue;
+                bench_opts.sizes[bench_opts.num_sizes][0] = n;
+                bench_opts.sizes[bench_opts.num_sizes][1] = n;
+                bench_opts.num_sizes++;
+            }
+        }
     }
 
     /* Install SIGSEGV and SIGALRM handlers */
@@ -239,11 +335,21 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    /* Time out and give up after a while */
-    alarm(120);
+    /* A simulator that died should not take the trace reader with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Time out and give up after a while, at the graded sizes */
+    if (M <= MAXN && N <= MAXN)
+        alarm(120);
 
     /* Check the performance of the student's transpose function */
     eval_perf(5, 1, 5);
+
+    /* Compare the simulated counts against real hardware */
+    if (run_bench) {
+        alarm(0); /* large sizes can take longer than the grading timeout */
+        benchTransFunctions(&bench_opts, M, N);
+    }
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
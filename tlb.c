@@ -0,0 +1,149 @@
+/*
+ * tlb.c - L1/L2 TLBs and x86-64 style page walks
+ *
+ * Each TLB level is an ordinary cache from init_cache whose "blocks"
+ * are pages, looked up with the virtual address like a data cache. When
+ * both levels miss, a four level radix walk is modelled: one 8 byte
+ * entry per level down to the level that maps the page size. Each
+ * level's table lives in its own synthetic region far above any user
+ * address, laid out so that neighbouring pages share page table lines
+ * like they do in a real page table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cachelab.h"
+#include "tlb.h"
+
+#define PTE_BYTES 8
+#define PAGE_TABLE_BASE (1UL << 60)
+#define PAGE_TABLE_STRIDE (1UL << 56)
+
+/* Virtual address bit where each level's index starts, root first */
+static const int level_shift[MAX_WALK_LEVELS] = {39, 30, 21, 12};
+
+static int log2_exact(int n)
+{
+    int bits = 0;
+    if (n <= 0 || (n & (n - 1)) != 0)
+        return -1;
+    while ((1 << bits) < n)
+        bits++;
+    return bits;
+}
+
+static int parse_level(const char *spec, int *entries, int *ways)
+{
+    if (sscanf(spec, "%d:%d", entries, ways) != 2)
+        return 0;
+    if (*entries <= 0 || *ways <= 0 || *entries % *ways != 0)
+        return 0;
+    return log2_exact(*entries / *ways) >= 0;
+}
+
+int parse_tlb_config(tlb_config *config, const char *spec, const char *page)
+{
+    const char *l2 = strchr(spec, ',');
+
+    memset(config, 0, sizeof(*config));
+    if (!parse_level(spec, &config->l1_entries, &config->l1_ways))
+        return 0;
+    if (l2 != NULL && !parse_level(l2 + 1, &config->l2_entries, &config->l2_ways))
+        return 0;
+
+    if (strcmp(page, "4k") == 0)
+        config->page_bits = 12;
+    else if (strcmp(page, "2m") == 0)
+        config->page_bits = 21;
+    else if (strcmp(page, "1g") == 0)
+        config->page_bits = 30;
+    else
+        return 0;
+    return 1;
+}
+
+tlb *init_tlb(tlb_config *config)
+{
+    tlb *new_tlb = alloc_or_die(1, sizeof(tlb), "TLB");
+    new_tlb->page_bits = config->page_bits;
+    new_tlb->l1 = init_cache(log2_exact(config->l1_entries / config->l1_ways),
+                             config->l1_ways, config->page_bits);
+    if (config->l2_entries > 0) {
+        new_tlb->l2 = init_cache(log2_exact(config->l2_entries / config->l2_ways),
+                                 config->l2_ways, config->page_bits);
+    }
+    return new_tlb;
+}
+
+/*
+ * tlb_level - Look address up in one level, filling it on a miss.
+ *     Returns 1 on a hit.
+ */
+static int tlb_level(cache *level, unsigned long address,
+                     int *hits, int *misses, int *evictions)
+{
+    int line = cache_lookup(level, address);
+    long victim;
+    unsigned char victim_flags;
+
+    if (line >= 0) {
+        *hits = *hits + 1;
+        cache_touch(level, address, line);
+        return 1;
+    }
+    *misses = *misses + 1;
+    if (cache_fill(level, address, &line, &victim, &victim_flags))
+        *evictions = *evictions + 1;
+    return 0;
+}
+
+int tlb_translate(tlb *instance_tlb, unsigned long address)
+{
+    if (tlb_level(instance_tlb->l1, address, &instance_tlb->l1_hits,
+                  &instance_tlb->l1_misses, &instance_tlb->l1_evictions))
+        return 0;
+    if (instance_tlb->l2 == NULL)
+        return 1;
+    return !tlb_level(instance_tlb->l2, address, &instance_tlb->l2_hits,
+                      &instance_tlb->l2_misses, &instance_tlb->l2_evictions);
+}
+
+int tlb_walk_addresses(tlb *instance_tlb, unsigned long address,
+                       unsigned long walk[MAX_WALK_LEVELS])
+{
+    int levels = 0;
+
+    // larger pages are mapped one or two levels closer to the root
+    for (int l = 0; l < MAX_WALK_LEVELS; l++) {
+        if (level_shift[l] < instance_tlb->page_bits)
+            break;
+        walk[levels++] = PAGE_TABLE_BASE + l * PAGE_TABLE_STRIDE +
+                         (address >> level_shift[l]) * PTE_BYTES;
+    }
+    return levels;
+}
+
+void print_tlb_summary(tlb *instance_tlb, int walks_to_cache)
+{
+    static const char *page_names[] = {[12] = "4k", [21] = "2m", [30] = "1g"};
+
+    printf("tlb %s: l1_hits:%d l1_misses:%d", page_names[instance_tlb->page_bits],
+           instance_tlb->l1_hits, instance_tlb->l1_misses);
+    if (instance_tlb->l2 != NULL) {
+        printf(" l2_hits:%d l2_misses:%d",
+               instance_tlb->l2_hits, instance_tlb->l2_misses);
+    }
+    if (walks_to_cache) {
+        printf(" walk_refs:%lu walk_misses:%lu",
+               instance_tlb->walk_refs, instance_tlb->walk_misses);
+    }
+    printf("\n");
+}
+
+void delete_tlb(tlb *instance_tlb)
+{
+    delete_cache(instance_tlb->l1);
+    if (instance_tlb->l2 != NULL)
+        delete_cache(instance_tlb->l2);
+    free(instance_tlb);
+}
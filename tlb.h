@@ -0,0 +1,46 @@
+/*
+ * tlb.h - Two level TLB simulation for csim
+ */
+
+#ifndef CACHELAB_TLB_H
+#define CACHELAB_TLB_H
+
+#include "cachelab.h"
+
+#define MAX_WALK_LEVELS 4
+
+typedef struct {
+    int l1_entries, l1_ways;
+    int l2_entries, l2_ways;  // l2_entries == 0 means no L2 TLB
+    int page_bits;            // 12, 21 or 30 for 4 KB, 2 MB or 1 GB pages
+} tlb_config;
+
+typedef struct {
+    cache *l1;                // TLBs are caches of pages rather than blocks
+    cache *l2;
+    int page_bits;
+    int l1_hits, l1_misses, l1_evictions;
+    int l2_hits, l2_misses, l2_evictions;
+    unsigned long walk_refs;  // page table loads sent to the data cache
+    unsigned long walk_misses;
+} tlb;
+
+/*
+ * parse_tlb_config - Fill config from "entries:ways[,entries:ways]" and
+ *     a page size of "4k", "2m" or "1g". Returns 0 on error.
+ */
+int parse_tlb_config(tlb_config *config, const char *spec, const char *page);
+
+tlb *init_tlb(tlb_config *config);
+/* Translate address, returns 1 if it missed every level and needs a walk */
+int tlb_translate(tlb *instance_tlb, unsigned long address);
+/*
+ * tlb_walk_addresses - Addresses of the page table entries a walk for
+ *     address loads, root first. Returns how many were written to walk.
+ */
+int tlb_walk_addresses(tlb *instance_tlb, unsigned long address,
+                       unsigned long walk[MAX_WALK_LEVELS]);
+void print_tlb_summary(tlb *instance_tlb, int walks_to_cache);
+void delete_tlb(tlb *instance_tlb);
+
+#endif /* CACHELAB_TLB_H */
@@ -1,23 +1,35 @@
-/* 
+/*
  * tracegen.c - Running the binary tracegen with valgrind produces
- * a memory trace of all of the registered transpose functions. 
- * 
+ * a memory trace of all of the registered transpose functions.
+ *
  * The beginning and end of each registered transpose function's trace
  * is indicated by reading from "marker" addresses. These two marker
- * addresses are recorded in file for later use.
+ * addresses, and the address ranges of A and B, are printed in the
+ * trace for later use.
+ *
+ * A and B are mapped at run time so any size works. A starts on an
+ * -a byte boundary and B starts -o bytes after the next boundary past
+ * the end of A, which decides how the rows of A and B collide in the
+ * cache. -H asks for huge pages, A then starts on a huge page while B
+ * keeps the placement given by -a and -o.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
-#include <assert.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include "cachelab.h"
 #include <string.h>
 
+#define HUGE_PAGE_SIZE (2UL << 20)
+#define VALIDATE_BLOCK 64 // validate tile edge, keeps B's column walk cached
+
 /* External variables declared in cachelab.c */
 extern trans_func_t func_list[MAX_TRANS_FUNCS];
-extern int func_counter; 
+extern int func_counter;
 
 /* External function from trans.c */
 extern void registerFunctions();
@@ -25,33 +37,86 @@ extern void registerFunctions();
 /* Markers used to bound trace regions of interest */
 volatile char MARKER_START, MARKER_END;
 
-static int A[256][256];
-static int B[256][256];
 static int M;
 static int N;
+static unsigned long align = 4096;
+static unsigned long offset = 0;
+static int huge_pages = 0;
 
 
+/*
+ * validate - Check B against A one tile at a time, so no copy of the
+ *     result is needed whatever the size
+ */
 int validate(int fn,int M, int N, int A[N][M], int B[M][N]) {
-    int C[M][N];
-    memset(C,0,sizeof(C));
-    correctTrans(M,N,A,C);
-    for(int i=0;i<M;i++) {
-        for(int j=0;j<N;j++) {
-            if(B[i][j]!=C[i][j]) {
-                printf("Validation failed on function %d! Expected %d but got %d at B[%d][%d]\n",fn,C[i][j],B[i][j],i,j);
-                return 0;
+    for (int ii = 0; ii < N; ii += VALIDATE_BLOCK) {
+        for (int jj = 0; jj < M; jj += VALIDATE_BLOCK) {
+            for (int i = ii; i < N && i < ii + VALIDATE_BLOCK; i++) {
+                for (int j = jj; j < M && j < jj + VALIDATE_BLOCK; j++) {
+                    if (B[j][i] != A[i][j]) {
+                        printf("Validation failed on function %d! Expected %d but got %d at B[%d][%d]\n",fn,A[i][j],B[j][i],j,i);
+                        return 0;
+                    }
+                }
             }
         }
     }
     return 1;
 }
 
+/*
+ * map_matrices - Map one region holding A and B placed as asked for
+ */
+static void map_matrices(void **A, void **B)
+{
+    unsigned long a_bytes = (unsigned long) M * N * sizeof(int);
+    unsigned long b_start = (a_bytes + align - 1) / align * align + offset;
+    unsigned long base_align = align;
+    char *region = MAP_FAILED;
+
+    if (huge_pages && base_align < HUGE_PAGE_SIZE)
+        base_align = HUGE_PAGE_SIZE;
+    unsigned long length = base_align + b_start + a_bytes;
+
+    if (huge_pages) {
+        length = (length + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        region = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region == MAP_FAILED) {
+            fprintf(stderr, "No hugetlb pages (%s), asking for transparent "
+                    "huge pages instead\n", strerror(errno));
+        }
+    }
+    if (region == MAP_FAILED) {
+        region = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            fprintf(stderr, "Error mapping %lu bytes for the matrices: %s\n",
+                    length, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (huge_pages)
+            madvise(region, length, MADV_HUGEPAGE);
+    }
+    // mmap is page aligned, smaller alignments are all satisfied by it
+    unsigned long base = (unsigned long) region;
+    base = (base + base_align - 1) / base_align * base_align;
+    *A = (void *) base;
+    *B = (void *) (base + b_start);
+}
+
+static int parse_power_of_two(char *arg, unsigned long *value)
+{
+    *value = strtoul(arg, NULL, 0);
+    return *value > 0 && (*value & (*value - 1)) == 0;
+}
+
 int main(int argc, char* argv[]){
     int i;
 
     char c;
     int selectedFunc=-1;
-    while( (c=getopt(argc,argv,"M:N:F:")) != -1){
+    while( (c=getopt(argc,argv,"M:N:F:a:o:H")) != -1){
         switch(c){
         case 'M':
             M = atoi(optarg);
@@ -62,27 +127,46 @@ int main(int argc, char* argv[]){
         case 'F':
             selectedFunc = atoi(optarg);
             break;
+        case 'a':
+            if (!parse_power_of_two(optarg, &align)) {
+                printf("./tracegen: -a must be a power of two.\n");
+                exit(1);
+            }
+            break;
+        case 'o':
+            offset = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            huge_pages = 1;
+            break;
         case '?':
         default:
             printf("./tracegen failed to parse its options.\n");
             exit(1);
         }
     }
-  
+    if (M <= 0 || N <= 0) {
+        printf("./tracegen needs -M and -N.\n");
+        exit(1);
+    }
 
     /*  Register transpose functions */
     registerFunctions();
 
-    /* Fill A with data */
-    initMatrix(M,N, A, B); 
-
-    /* Record marker addresses */
-    FILE* marker_fp = fopen(".marker","w");
-    assert(marker_fp);
-    fprintf(marker_fp, "%llx %llx", 
-            (unsigned long long int) &MARKER_START,
-            (unsigned long long int) &MARKER_END );
-    fclose(marker_fp);
+    /* Map and fill A with data */
+    void *A, *B;
+    map_matrices(&A, &B);
+    initMatrix(M,N, A, B);
+
+    /* Print marker and matrix addresses, test-trans filters the trace as
+       it streams so it is told in band */
+    unsigned long long bytes = (unsigned long long) M * N * sizeof(int);
+    printf("\nMARKERS %llx %llx %llx %llx %llx %llx\n",
+           (unsigned long long int) &MARKER_START,
+           (unsigned long long int) &MARKER_END,
+           (unsigned long long int) A, (unsigned long long int) A + bytes,
+           (unsigned long long int) B, (unsigned long long int) B + bytes);
+    fflush(stdout);
 
     if (-1==selectedFunc) {
         /* Invoke registered transpose functions */
@@ -0,0 +1,256 @@
+/*
+ * tracepar.c - Trace parsing spread over several threads
+ *
+ * Any free worker takes the trace lock, reads the next chunk and cuts it
+ * after its last newline, the rest is carried over to the next chunk.
+ * Reading is cheap next to decoding hex, so the lock is held only for the
+ * read and the decoding into a batch of binary records runs in parallel.
+ * Chunk n goes to slot n % slots, and is only read once the simulation
+ * thread gave that slot back, which bounds the memory in flight and lets
+ * the simulation thread take the batches in trace order.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "cachelab.h"
+#include "tracepar.h"
+
+#define CHUNK_SIZE (1 << 16)
+#define MAX_FAST_HEX_DIGITS 15  // no overflow to worry about
+#define MAX_FAST_DEC_DIGITS 9
+
+typedef struct {
+    char *text;
+    size_t length;
+    int ready;               // parsed and waiting for the simulation
+    trace_batch batch;
+} chunk_slot;
+
+struct trace_reader {
+    FILE *f_stream;
+    int line_size;
+    int threads;
+    pthread_t workers[MAX_PARSE_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+    pthread_cond_t slot_ready;
+    chunk_slot *slots;
+    unsigned long slot_count;
+    unsigned long next_chunk;  // sequence number of the next chunk read
+    unsigned long consumed;    // chunks handed back by the simulation
+    int holding;               // the simulation thread holds a batch
+    int eof;
+    char *carry;               // start of a line cut off by the last read
+    size_t carry_length;
+    unsigned long offset;      // trace bytes read, carry included
+};
+
+static inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * parse_line - Decode one fgets line of length bytes. The common
+ *     "op hex,dec" shape is decoded by hand, everything else goes to the
+ *     same sscanf csim uses so odd lines come out exactly the same.
+ */
+static void parse_line(const char *line, size_t length, trace_record *record)
+{
+    const char *p = line, *end = line + length;
+    unsigned long address = 0;
+    int size = 0, digits, value;
+    char op;
+
+    while (p < end && *p == ' ')
+        p++;
+    if (p == end || !((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')))
+        goto slow;
+    op = *p++;
+    if (p == end || *p != ' ')
+        goto slow;
+    while (p < end && *p == ' ')
+        p++;
+    for (digits = 0; p < end && (value = hex_value(*p)) >= 0; digits++, p++)
+        address = (address << 4) | value;
+    if (digits == 0 || digits > MAX_FAST_HEX_DIGITS || p == end || *p != ',')
+        goto slow;
+    p++;
+    for (digits = 0; p < end && *p >= '0' && *p <= '9'; digits++, p++)
+        size = size * 10 + (*p - '0');
+    if (digits == 0 || digits > MAX_FAST_DEC_DIGITS)
+        goto slow;
+    record->op = op;
+    record->address = address;
+    record->size = size;
+    record->fields = 3;
+    return;
+
+slow:;
+    char buffer[length + 1];
+    memcpy(buffer, line, length);
+    buffer[length] = '\0';
+    int fields = sscanf(buffer, " %c %lx,%d", &record->op,
+                        &record->address, &record->size);
+    record->fields = fields > 0 ? fields : 0;
+}
+
+static void parse_chunk(trace_reader *reader, chunk_slot *slot)
+{
+    const char *p = slot->text, *end = slot->text + slot->length;
+    size_t max_line = reader->line_size - 1;
+    int count = 0;
+
+    while (p < end) {
+        size_t left = end - p < max_line ? end - p : max_line;
+        const char *newline = memchr(p, '\n', left);
+        size_t length = newline != NULL ? newline - p + 1 : left;
+        parse_line(p, length, &slot->batch.records[count++]);
+        p += length;
+    }
+    slot->batch.count = count;
+}
+
+/*
+ * read_chunk - Fill slot with the carried over bytes and the next read,
+ *     keeping back what follows the last complete line. Chunks always
+ *     start where fgets would start a line. Called with the lock held.
+ */
+static void read_chunk(trace_reader *reader, chunk_slot *slot)
+{
+    size_t max_line = reader->line_size - 1;
+    size_t length, cut;
+
+    memcpy(slot->text, reader->carry, reader->carry_length);
+    length = reader->carry_length +
+             fread(slot->text + reader->carry_length, 1,
+                   CHUNK_SIZE - reader->carry_length, reader->f_stream);
+    reader->offset += length - reader->carry_length;
+
+    if (length < CHUNK_SIZE) {
+        cut = length; // a short read is the end of the trace
+    } else {
+        char *newline = memrchr(slot->text, '\n', length);
+        // without a newline fgets splits the line every max_line bytes
+        cut = newline != NULL ? (size_t) (newline - slot->text + 1) :
+              length - length % max_line;
+    }
+    reader->carry_length = length - cut;
+    memcpy(reader->carry, slot->text + cut, reader->carry_length);
+    slot->length = cut;
+    slot->batch.end_offset = reader->offset - reader->carry_length;
+}
+
+static void *parse_worker(void *arg)
+{
+    trace_reader *reader = arg;
+
+    pthread_mutex_lock(&reader->lock);
+    for (;;) {
+        while (!reader->eof &&
+               reader->next_chunk >= reader->consumed + reader->slot_count)
+            pthread_cond_wait(&reader->slot_free, &reader->lock);
+        if (reader->eof)
+            break;
+        chunk_slot *slot = &reader->slots[reader->next_chunk % reader->slot_count];
+        read_chunk(reader, slot);
+        if (slot->length == 0) {
+            reader->eof = 1;
+            pthread_cond_broadcast(&reader->slot_free);
+            pthread_cond_broadcast(&reader->slot_ready);
+            break;
+        }
+        reader->next_chunk++;
+        pthread_mutex_unlock(&reader->lock);
+
+        parse_chunk(reader, slot);
+
+        pthread_mutex_lock(&reader->lock);
+        slot->ready = 1;
+        pthread_cond_broadcast(&reader->slot_ready);
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+trace_reader *open_trace_reader(FILE *f_stream, int threads, int line_size)
+{
+    trace_reader *reader = alloc_or_die(1, sizeof(trace_reader), "trace parser");
+
+    if (threads > MAX_PARSE_THREADS)
+        threads = MAX_PARSE_THREADS;
+    reader->f_stream = f_stream;
+    reader->line_size = line_size < CHUNK_SIZE ? line_size : CHUNK_SIZE;
+    reader->threads = threads;
+    // enough slots for every worker to parse while the simulation runs
+    reader->slot_count = 2 * threads;
+    reader->slots = alloc_or_die(reader->slot_count, sizeof(chunk_slot),
+                                 "trace parser");
+    for (unsigned long i = 0; i < reader->slot_count; i++) {
+        reader->slots[i].text = alloc_or_die(CHUNK_SIZE, 1, "trace parser");
+        // one record per byte is the most a chunk can hold
+        reader->slots[i].batch.records = alloc_or_die(CHUNK_SIZE,
+                                                      sizeof(trace_record),
+                                                      "trace parser");
+    }
+    reader->carry = alloc_or_die(CHUNK_SIZE, 1, "trace parser");
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->slot_free, NULL);
+    pthread_cond_init(&reader->slot_ready, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        int err = pthread_create(&reader->workers[i], NULL, parse_worker, reader);
+        if (err != 0) {
+            fprintf(stderr, "Could not start trace parser: %s\n", strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+    return reader;
+}
+
+trace_batch *next_trace_batch(trace_reader *reader)
+{
+    trace_batch *batch = NULL;
+
+    pthread_mutex_lock(&reader->lock);
+    if (reader->holding) {
+        reader->slots[reader->consumed % reader->slot_count].ready = 0;
+        reader->consumed++;
+        reader->holding = 0;
+        pthread_cond_broadcast(&reader->slot_free);
+    }
+    chunk_slot *slot = &reader->slots[reader->consumed % reader->slot_count];
+    while (!slot->ready && !(reader->eof && reader->consumed == reader->next_chunk))
+        pthread_cond_wait(&reader->slot_ready, &reader->lock);
+    if (slot->ready) {
+        reader->holding = 1;
+        batch = &slot->batch;
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return batch;
+}
+
+void close_trace_reader(trace_reader *reader)
+{
+    for (int i = 0; i < reader->threads; i++)
+        pthread_join(reader->workers[i], NULL);
+    for (unsigned long i = 0; i < reader->slot_count; i++) {
+        free(reader->slots[i].text);
+        free(reader->slots[i].batch.records);
+    }
+    free(reader->slots);
+    free(reader->carry);
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->slot_free);
+    pthread_cond_destroy(&reader->slot_ready);
+    free(reader);
+}
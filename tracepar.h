@@ -0,0 +1,41 @@
+/*
+ * tracepar.h - Trace parsing spread over several threads
+ */
+
+#ifndef CACHELAB_TRACEPAR_H
+#define CACHELAB_TRACEPAR_H
+
+#include <stdio.h>
+
+#define MAX_PARSE_THREADS 64
+
+/*
+ * One fgets line of the trace. fields is what sscanf(" %c %lx,%d")
+ * returned for it, clamped to 0: the fields after the first fields ones
+ * were not assigned and keep the value of the line before.
+ */
+typedef struct {
+    unsigned long address;
+    int size;
+    char op;
+    char fields;
+} trace_record;
+
+typedef struct {
+    trace_record *records;
+    int count;
+    unsigned long end_offset; // trace bytes consumed after this batch
+} trace_batch;
+
+typedef struct trace_reader trace_reader;
+
+/*
+ * open_trace_reader - Start threads parsing f_stream in chunks. Lines are
+ *     cut every line_size - 1 bytes like fgets with a line_size buffer.
+ */
+trace_reader *open_trace_reader(FILE *f_stream, int threads, int line_size);
+/* Next batch in trace order, NULL at the end. Invalidates the last one. */
+trace_batch *next_trace_batch(trace_reader *reader);
+void close_trace_reader(trace_reader *reader);
+
+#endif /* CACHELAB_TRACEPAR_H */